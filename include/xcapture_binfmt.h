@@ -0,0 +1,97 @@
+/*
+ *  0x.Tools xCapture - sample thread activity from Linux procfs [https://0x.tools]
+ *  Copyright 2019-2021 Tanel Poder
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ *  On-disk layout of the -F binary output files (.xcap), shared between the
+ *  writer in src/xcapture.c and the src/xcsv.c converter.
+ *
+ *  A file starts with a fixed header:
+ *      char magic[4]   "XCAP"
+ *      u16  version    XCAP_BIN_VERSION
+ *      u16  colflags   bitmap of the optional columns present in every row
+ *
+ *  followed by a stream of tagged records in native byte order:
+ *
+ *  dictionary record (one per distinct string, ids count up from 0 per file):
+ *      u8   tag        XCAP_TAG_DICT
+ *      u32  id
+ *      u16  len        string length, no terminator stored
+ *      char str[len]
+ *
+ *  row record (string columns reference dictionary ids):
+ *      u8   tag        XCAP_TAG_ROW
+ *      u64  ts_ms      sample timestamp, milliseconds since the epoch
+ *      i32  pid
+ *      i32  tid
+ *      u32  username_id
+ *      u8   state      single letter task state
+ *      u32  comm_id
+ *      u32  syscall_id
+ *      u32  wchan_id
+ *  then, only for the columns flagged in the file header, in this order:
+ *      u32  exe_id
+ *      u32  cmdline_id
+ *      i64  cputicks       (XCAP_BIN_NOVAL when not available yet)
+ *      i64  minflt, majflt (both present when XCAP_COL_FLT is set)
+ *      i64  rss
+ *      i64  prio
+ *      i64  cpuid
+ *      i64  cpupct10, latpct10 (both present when XCAP_COL_SCHED is set: on-cpu and
+ *                               runqueue-wait percent of wall time x10, from schedstat)
+ *      u32  kstack_id
+ *
+ *  concurrent -j workers may intern the same string at the same moment, so a row
+ *  can precede the dictionary record it references - readers must collect the
+ *  whole dictionary before rendering rows.
+ */
+
+#ifndef XCAPTURE_BINFMT_H
+#define XCAPTURE_BINFMT_H
+
+#define XCAP_BIN_MAGIC   "XCAP"
+#define XCAP_BIN_VERSION 1
+
+#define XCAP_TAG_DICT 'D'
+#define XCAP_TAG_ROW  'R'
+
+/* optional column bits in the file header, also the row field order */
+#define XCAP_COL_EXE     0x0001
+#define XCAP_COL_CMDLINE 0x0002
+#define XCAP_COL_CPUTIME 0x0004
+#define XCAP_COL_FLT     0x0008
+#define XCAP_COL_RSS     0x0010
+#define XCAP_COL_PRIO    0x0020
+#define XCAP_COL_CPUID   0x0040
+#define XCAP_COL_KSTACK  0x0080
+#define XCAP_COL_SCHED   0x0100
+
+/* sentinel for "no value", rendered back as "-" by xcsv */
+#define XCAP_BIN_NOVAL (-0x8000000000000000LL)
+
+/*
+ * time index sidecar (<outfile>.xidx), written at rotation for uncompressed -o
+ * files and consumed by bin/xq for time-range seeks:
+ *     char magic[4]   "XIDX"
+ *     u32  version    XCAP_IDX_VERSION
+ *  then one entry per sample, ascending:
+ *     u64  ts_ms      sample timestamp, milliseconds since the epoch
+ *     u64  offset     byte offset of the first row of that sample
+ */
+#define XCAP_IDX_MAGIC   "XIDX"
+#define XCAP_IDX_VERSION 1
+
+/*
+ * --ship wire format: each writer batch is sent to the collector as one frame,
+ * in native byte order like everything above:
+ *     u32  len     payload bytes following the flags byte
+ *     u8   flags   XCAP_SHIP_ZSTD = the payload is a standalone zstd frame
+ *     payload      CSV bytes as an -o file would contain them; the first frame
+ *                  of every connection carries the column header line
+ * delivery is at-least-once, frames spooled locally during a disconnect may be
+ * resent - collectors that care should dedup on (host, first row timestamp)
+ */
+#define XCAP_SHIP_ZSTD 0x01
+
+#endif
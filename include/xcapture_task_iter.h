@@ -0,0 +1,29 @@
+/*
+ *  0x.Tools xCapture - sample thread activity from Linux procfs [https://0x.tools]
+ *  Copyright 2019-2021 Tanel Poder
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ *  Fixed-size record streamed from the BPF task iterator program
+ *  (src/xcapture_task_iter.bpf.c) to the --engine=bpf loader in src/xcapture.c.
+ *  Keep this layout in sync between the two, both sides include this header.
+ */
+
+#ifndef XCAPTURE_TASK_ITER_H
+#define XCAPTURE_TASK_ITER_H
+
+#define XCAP_BPF_MAX_KSTACK 48  /* frames kept per task, innermost first */
+
+struct xcap_bpf_rec {
+    int tgid;
+    int pid;
+    unsigned int uid;
+    unsigned int state;          /* raw task->__state bits */
+    unsigned int exit_state;     /* raw task->exit_state bits (zombie/dead) */
+    int syscall_nr;              /* current syscall number, -1 = not in a syscall */
+    unsigned int kstack_bytes;   /* bytes filled in kstack[] by bpf_get_task_stack() */
+    char comm[16];
+    unsigned long long kstack[XCAP_BPF_MAX_KSTACK];
+};
+
+#endif
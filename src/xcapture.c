@@ -39,241 +39,3705 @@
 #include <sys/stat.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include <fnmatch.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define HAVE_URING 1
+#endif
 
 #include <syscall_names.h>
+#include <xcapture_task_iter.h>
+#include <xcapture_binfmt.h>
+#ifdef HAVE_LIBBPF
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+#endif
 
 #define WSP " \n" // whitespace
 #define MAXFILEBUF 4096
 
 int DEBUG = 0;
 
-char filebuf[MAXFILEBUF]; // filebuf global temp area by design
-char statbuf[MAXFILEBUF]; // filebuf global temp area by design (special for /proc/PID/stat value passing optimization)
-char exclude_states[10] = "XZIS"; // do not show tasks in Sleeping state by default
+// single-pass field index over a /proc/PID/stat line, 1-based like the proc(5) numbering.
+// comm (field 2) may contain spaces and parens, so fields from 3 on are located from the
+// last ')'. statindex() terminates the fields in place, so index the buffer exactly once
+#define STAT_MAXFIELDS 52
+
+struct statidx {
+    char *f[STAT_MAXFIELDS + 1];  // f[1] = pid, f[2] = "(comm)", ... NULL when missing
+    int n;                        // highest populated field number
+    char state;                   // f[3][0] for the task state checks
+};
 
 char *output_dir = NULL;  // use stdout if output_dir is not set
+long long sample_ts_ms = 0; // current sample timestamp for -F binary rows
+
+// -o archive management: optional streaming zstd compression (make zstd builds), size
+// based rotation on top of the hourly one, and a retention cap on the directory total
+int compress_out = 0;        // --compress: write .zst directly from the writer thread
+long long rotate_bytes = 0;  // --rotate-mb: also rotate when the current file reaches this
+long long retain_bytes = 0;  // --retain-mb: delete oldest output files above this total
+long long out_written = 0;   // bytes written into the current output file (on-disk size)
+int rotate_seq = 0;          // filename suffix counter for same-hour size rotations
 int  header_printed = 0;
 char output_format = 'S'; // S -> space-delimited fixed output format, C -> CSV
 char outsep = ' ';
 int  pad = 1;             // output field padding (for space-delimited fixed-width output)
-  
+
+// append-only output buffer with direct formatters. row emission used to be dozens of
+// fprintf() calls per line (a format string parse and a stdio lock per field) - now every
+// field is memcpy'd or converted straight into a per-sample arena and the whole sample is
+// flushed with one writev() at the end
+struct obuf {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+void ob_reserve(struct obuf *ob, size_t need) {
+    if (ob->len + need <= ob->cap) return;
+    ob->cap = ob->cap ? ob->cap : 1 << 16;
+    while (ob->len + need > ob->cap) ob->cap *= 2;
+    ob->buf = realloc(ob->buf, ob->cap);
+    if (!ob->buf) { fprintf(stderr, "out of memory growing output buffer\n"); exit(1); }
+}
+
+void ob_putc(struct obuf *ob, char c) {
+    ob_reserve(ob, 1);
+    ob->buf[ob->len++] = c;
+}
+
+void ob_mem(struct obuf *ob, const void *p, size_t n) {
+    if (!n) return; // an untouched arena has a NULL buf, don't hand that to memcpy
+    ob_reserve(ob, n);
+    memcpy(ob->buf + ob->len, p, n);
+    ob->len += n;
+}
+
+void ob_str(struct obuf *ob, const char *str) {
+    ob_mem(ob, str, strlen(str));
+}
+
+// decimal conversion without the stdio machinery: digits produced backwards into scratch
+int fmt_u64(char *dst, unsigned long long v) {
+    char tmp[20];
+    int i = sizeof(tmp);
+    do { tmp[--i] = '0' + v % 10; v /= 10; } while (v);
+    memcpy(dst, tmp + i, sizeof(tmp) - i);
+    return sizeof(tmp) - i;
+}
+
+int fmt_i64(char *dst, long long v) {
+    if (v < 0) {
+        dst[0] = '-';
+        return 1 + fmt_u64(dst + 1, (unsigned long long) -v);
+    }
+    return fmt_u64(dst, v);
+}
+
+// left-justified field: string padded to width plus a space in fixed mode, string plus
+// the separator in CSV mode - the "%-25s%c" pattern of the old fprintf output
+void ob_field(struct obuf *ob, const char *str, int width) {
+    int n = strlen(str);
+    ob_mem(ob, str, n);
+    if (pad) {
+        ob_reserve(ob, (n < width ? width - n : 0) + 1); // overlong strings still get their space
+        for (; n < width; n++) ob->buf[ob->len++] = ' ';
+        ob->buf[ob->len++] = ' ';
+    }
+    else ob_putc(ob, outsep);
+}
+
+// right-justified field, the "%7s " / "%8llu " patterns
+void ob_rfield(struct obuf *ob, const char *str, int width) {
+    int n = strlen(str);
+    if (pad) {
+        ob_reserve(ob, (n < width ? width : n) + 1);
+        for (; n < width; width--) ob->buf[ob->len++] = ' ';
+    }
+    ob_mem(ob, str, n);
+    ob_putc(ob, pad ? ' ' : outsep);
+}
+
+void ob_num(struct obuf *ob, long long v, int width) {
+    char tmp[24];
+    tmp[fmt_i64(tmp, v)] = 0;
+    ob_rfield(ob, tmp, width);
+}
+
+void ob_hex(struct obuf *ob, unsigned long long v) {
+    char tmp[16];
+    int i = sizeof(tmp);
+    do { tmp[--i] = "0123456789abcdef"[v % 16]; v /= 16; } while (v);
+    ob_str(ob, "0x");
+    ob_mem(ob, tmp + i, sizeof(tmp) - i);
+    ob_putc(ob, pad ? ' ' : outsep);
+}
+
+// per-worker capture context, one per sampling thread (-j). the old global filebuf/statbuf
+// temp areas live in here now so that concurrent workers don't trample each other's reads
+struct capture_ctx {
+    char filebuf[MAXFILEBUF];     // temp area for per-task file reads
+    char statbuf[MAXFILEBUF];     // special temp area for /proc/PID/stat value passing optimization
+    struct obuf ob;               // this thread's sample output arena, reset every sample
+    struct obuf kscratch;         // kstack formatting scratch for -F binary interning
+    int  print_header;            // serial mode prints the stdout header lazily, workers never do
+    long emitted;                 // rows emitted by this worker during the current sample
+    long dstate;                  // of which in D state, feeds the --ring-trigger-d check
+    char *pre_stat;               // pre-read file contents handed over by the io_uring engine,
+    char *pre_syscall;            // NULL means outputprocentry() reads the file itself
+    char *pre_wchan;
+    int  pre_statn;
+    int  pre_syscalln;
+    int  pre_wchann;
+    void *ring;                   // this thread's io_uring (struct uring), created lazily
+    int  ring_failed;             // io_uring turned out unavailable, use synchronous reads
+    struct statidx statidx;       // pid-level stat index handed from sampleprocess() to
+    int  statidx_valid;           // outputprocentry(), avoiding a second read and parse
+};
+
+// worker pool state, only used with -j N where N > 1
+struct worker {
+    pthread_t thread;
+    struct capture_ctx ctx;
+    int id;
+};
+
+char exclude_states[10] = "XZIS"; // do not show tasks in Sleeping state by default
+
+#define ENGINE_PROC  0    // default: synchronous pread()s through the fd cache
+#define ENGINE_URING 1    // --engine=uring: batched io_uring submission of the hot file reads
+#define ENGINE_BPF   2    // --engine=bpf: one-pass BPF task iterator snapshot (make ebpf builds)
+int engine = ENGINE_PROC;
+
+#define TASKLIST_SCAN    0  // default: full /proc readdir walk every sample
+#define TASKLIST_NETLINK 1  // --tasklist=netlink: incremental tracking via the proc connector
+int tasklist_mode = TASKLIST_SCAN;
+char *cgroup_dir = NULL;    // --cgroup: enumerate only this cgroup subtree, no /proc walk
+char *procfs_root = "/proc"; // --proc: sample a different tree, e.g. a --record snapshot
+
+// pre-read filter engine: -p / -u / --comm / --syscall are compiled at startup into
+// cheap predicates (pid bitmap, uid list, comm glob, syscall number bitmap) that are
+// evaluated as early in the walk as each piece of information exists - the pid before
+// anything is read, the uid after one dirfd stat, the comm after the process stat
+// read and the syscall right after the syscall read - so chasing one application no
+// longer pays the full-host sampling and post-processing cost
+unsigned char *filter_pidmap = NULL;  // -p: bit per pid, sized to the largest pid given
+int filter_pidmax = -1;
+
+#define MAXFILTER_UIDS 16
+uid_t filter_uid[MAXFILTER_UIDS];     // -u
+int nfilter_uid = 0;
+
+char *filter_comm = NULL;             // --comm: fnmatch() glob against the comm
+
+unsigned char filter_sysmap[(NR_SYSCALLS + 7) / 8]; // --syscall
+int filter_sys_on = 0;
+int filter_sys_running = 0;           // --syscall included "running" (on-CPU tasks)
+int filter_sys_none = 0;              // --syscall included "none" (in kernel, no syscall)
+
+int filter_pid_pass(int pid) {
+    if (!filter_pidmap) return 1;
+    return pid <= filter_pidmax && (filter_pidmap[pid / 8] >> (pid % 8) & 1);
+}
+
+int filter_uid_pass(uid_t uid) {
+    int i;
+    for (i = 0; i < nfilter_uid; i++)
+        if (filter_uid[i] == uid) return 1;
+    return !nfilter_uid;
+}
+
+// str may be the "(comm)" stat token, a whole stat line or a bare comm - the glob
+// matches what sits between the outermost parentheses when there are any
+int filter_comm_pass(const char *str) {
+    char tmp[40];
+    const char *lp, *rp;
+    int n;
+
+    if (!filter_comm) return 1;
+    lp = strchr(str, '(');
+    rp = strrchr(str, ')');
+    if (lp && rp && rp > lp) {
+        n = rp - lp - 1;
+        if (n > (int) sizeof(tmp) - 1) n = sizeof(tmp) - 1;
+        memcpy(tmp, lp + 1, n);
+        tmp[n] = 0;
+        str = tmp;
+    }
+    return !fnmatch(filter_comm, str, 0);
+}
+
+// nr as the sampler sees it: >= 0 syscall number, -1 in kernel without a syscall,
+// -2 "running" (likely userspace)
+int filter_sys_pass(int nr) {
+    if (!filter_sys_on) return 1;
+    if (nr == -2) return filter_sys_running;
+    if (nr < 0 || nr >= (int) NR_SYSCALLS) return filter_sys_none;
+    return filter_sysmap[nr / 8] >> (nr % 8) & 1;
+}
+
+// peek the leading token of a /proc/PID/task/TID/syscall read without tokenizing it
+int syscall_nr_peek(const char *buf, int n) {
+    if (n <= 0) return -1;
+    if (buf[0] == 'r') return -2;
+    return atoi(buf);
+}
+
+int filter_parse_pids(char *arg) {
+    char *p;
+    int pid, maxpid = 0;
+
+    for (p = arg; *p; p++)
+        if (*p == ',') *p = ' ';
+    for (p = arg; *p; ) {
+        pid = (int) strtol(p, &p, 10);
+        if (pid <= 0) return -1;
+        if (pid > maxpid) maxpid = pid;
+        while (*p == ' ') p++;
+    }
+    if (!maxpid) return -1;
+    filter_pidmap = calloc(maxpid / 8 + 1, 1);
+    if (!filter_pidmap) return -1;
+    filter_pidmax = maxpid;
+    for (p = arg; *p; ) {
+        pid = (int) strtol(p, &p, 10);
+        filter_pidmap[pid / 8] |= 1 << (pid % 8);
+        while (*p == ' ') p++;
+    }
+    return 0;
+}
+
+int filter_parse_users(char *arg) {
+    char *name, *end;
+    struct passwd *pw;
+    long uid;
+
+    while ((name = strsep(&arg, ","))) {
+        if (!*name) continue;
+        if (nfilter_uid == MAXFILTER_UIDS) return -1;
+        uid = strtol(name, &end, 10);
+        if (!*end)
+            filter_uid[nfilter_uid++] = (uid_t) uid;
+        else if ((pw = getpwnam(name)))
+            filter_uid[nfilter_uid++] = pw->pw_uid;
+        else {
+            fprintf(stderr, "Option -u: unknown user - %s\n", name);
+            return -1;
+        }
+    }
+    return nfilter_uid ? 0 : -1;
+}
+
+int filter_parse_syscalls(char *arg) {
+    char *name;
+    unsigned int i;
+    int found;
+
+    while ((name = strsep(&arg, ","))) {
+        if (!*name) continue;
+        if (!strcmp(name, "running")) { filter_sys_running = 1; filter_sys_on = 1; continue; }
+        if (!strcmp(name, "none"))    { filter_sys_none = 1;    filter_sys_on = 1; continue; }
+        found = 0;
+        for (i = 0; i < NR_SYSCALLS; i++)
+            if (sysent0[i].name && !strcmp(sysent0[i].name, name)) {
+                filter_sysmap[i / 8] |= 1 << (i % 8);
+                found = 1;
+            }
+        if (!found) {
+            fprintf(stderr, "Option --syscall: unknown syscall name - %s\n", name);
+            return -1;
+        }
+        filter_sys_on = 1;
+    }
+    return filter_sys_on ? 0 : -1;
+}
+
+// --stats self-instrumentation: cheap log2 histograms around the phases that can make
+// the sampler fall behind (pid listing, the per-file-type /proc reads, username
+// resolution, the output write) plus scan/emit/overrun counters, reported as one
+// machine-readable stderr line every N samples. this is how the effect of every other
+// performance knob gets validated in production. the counters are bumped without
+// locks and are approximate under concurrent -j workers, like stkc_entries
+int stats_every = 0;        // --stats: report every N samples, 0 = mode off
+long ticks_dropped = 0;     // sampling intervals skipped because a scan overran
+
+enum { PH_LIST, PH_STAT, PH_SYSCALL, PH_WCHAN, PH_STACK, PH_OTHERFILE, PH_UNAME, PH_WRITE,
+       PH_NPHASES };
+const char *phase_names[PH_NPHASES] = { "list", "stat", "syscall", "wchan", "stack",
+                                        "otherfile", "uname", "write" };
+struct phist {
+    unsigned long bkt[32];  // bkt[i] counts durations in [2^i, 2^(i+1)) microseconds
+    unsigned long long count;
+    unsigned long long sum;
+};
+struct phist phases[PH_NPHASES];
+long stats_scanned = 0;     // tasklist entries handed to the samplers this window
+long stats_emitted = 0;     // rows emitted this window
+int stats_samples = 0;      // samples accumulated into the current window
+
+unsigned long long stats_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void phist_add(int ph, unsigned long long us) {
+    int b = 0;
+    while (us >> (b + 1) && b < 31) b++;
+    phases[ph].bkt[b]++;
+    phases[ph].count++;
+    phases[ph].sum += us;
+}
+
+int stats_phase(const char *name) { // readfile() callers pass the /proc file name
+    if (!strcmp(name, "stat"))    return PH_STAT;
+    if (!strcmp(name, "syscall")) return PH_SYSCALL;
+    if (!strcmp(name, "wchan"))   return PH_WCHAN;
+    if (!strcmp(name, "stack"))   return PH_STACK;
+    return PH_OTHERFILE;
+}
+
+// upper bound of the bucket holding the q-th percentile observation
+unsigned long long phist_pct(struct phist *h, int q) {
+    unsigned long long need = (h->count * q + 99) / 100, seen = 0;
+    int b;
+    for (b = 0; b < 32; b++) {
+        seen += h->bkt[b];
+        if (seen >= need) return 1ull << (b + 1);
+    }
+    return 0;
+}
+
+// uid -> username cache. NSS lookups can block on the network (sssd/LDAP), so the sampling
+// path only ever does a hash lookup here: unknown or expired uids are handed to a resolver
+// thread and the numeric uid (or the stale name) is printed until the fresh name arrives.
+// confirmed-unresolvable uids are cached negatively as "-" so they are not retried per line
+#define UIDC_BUCKETS 1024
+#define UIDC_TTL 300            // seconds before a cached name is refreshed (asynchronously)
+
+struct uidc_entry {
+    uid_t uid;
+    char name[33];              // resolved username, numeric uid while in flight, "-" if negative
+    time_t expires;
+    int resolving;              // already queued for the resolver thread
+    struct uidc_entry *next;
+};
+
+struct uidc_entry *uidc[UIDC_BUCKETS];
+pthread_mutex_t uidc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define UIDC_QUEUE 1024
+uid_t uidc_queue[UIDC_QUEUE];   // resolver work queue (ring), overflow is dropped and retried
+int uidc_qhead = 0, uidc_qtail = 0;
+pthread_cond_t uidc_qcond = PTHREAD_COND_INITIALIZER;
+
+int uidc_enqueue(uid_t uid) { // caller holds uidc_lock
+    int next = (uidc_qtail + 1) % UIDC_QUEUE;
+    if (next == uidc_qhead) return -1; // queue full, the caller leaves the entry
+                                       // unmarked so the next sample retries
+    uidc_queue[uidc_qtail] = uid;
+    uidc_qtail = next;
+    pthread_cond_signal(&uidc_qcond);
+    return 0;
+}
+
+void *uidc_resolver_main(void *arg) {
+    struct passwd pwbuf, *pw;
+    char strbuf[4096];
+    struct uidc_entry *e;
+    uid_t uid;
+
+    (void) arg;
+    pthread_mutex_lock(&uidc_lock);
+    for (;;) {
+        while (uidc_qhead == uidc_qtail)
+            pthread_cond_wait(&uidc_qcond, &uidc_lock);
+        uid = uidc_queue[uidc_qhead];
+        uidc_qhead = (uidc_qhead + 1) % UIDC_QUEUE;
+        pthread_mutex_unlock(&uidc_lock);
+
+        pw = NULL;
+        getpwuid_r(uid, &pwbuf, strbuf, sizeof(strbuf), &pw); // may block on NSS, that is fine here
+
+        pthread_mutex_lock(&uidc_lock);
+        for (e = uidc[uid % UIDC_BUCKETS]; e; e = e->next) {
+            if (e->uid == uid) {
+                strncpy(e->name, pw ? pw->pw_name : "-", sizeof(e->name) - 1);
+                e->name[sizeof(e->name) - 1] = 0;
+                e->expires = time(NULL) + UIDC_TTL;
+                e->resolving = 0;
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+const char *getusername_cached(uid_t uid)
+{
+    struct uidc_entry *e;
+    const char *name;
+
+    pthread_mutex_lock(&uidc_lock);
+    for (e = uidc[uid % UIDC_BUCKETS]; e; e = e->next) {
+        if (e->uid == uid) {
+            if (!e->resolving && time(NULL) > e->expires) // serve stale, refresh in background
+                e->resolving = !uidc_enqueue(uid);
+            name = e->name;
+            pthread_mutex_unlock(&uidc_lock);
+            return name;
+        }
+    }
+
+    // first sighting of this uid: print it numerically until the resolver comes back
+    e = calloc(1, sizeof(struct uidc_entry));
+    if (!e) { pthread_mutex_unlock(&uidc_lock); return "-"; }
+    e->uid = uid;
+    sprintf(e->name, "%u", uid);
+    e->next = uidc[uid % UIDC_BUCKETS];
+    uidc[uid % UIDC_BUCKETS] = e;
+    e->resolving = !uidc_enqueue(uid);
+    name = e->name;
+    pthread_mutex_unlock(&uidc_lock);
+    return name;
+}
+
 const char *getusername(uid_t uid)
 {
-  struct passwd *pw = getpwuid(uid);
-  if (pw)
-  {
-    return pw->pw_name;
-  }
+    unsigned long long t0;
+    const char *name;
 
-  return "-";
+    if (!stats_every) return getusername_cached(uid);
+    t0 = stats_now_us();
+    name = getusername_cached(uid);
+    phist_add(PH_UNAME, stats_now_us() - t0);
+    return name;
 }
 
 
-int readfile(int pid, int tid, const char *name, char *buf)
-{
-    int fd, bytes = 0;
-    char path[256];
+// fd cache: keep a dirfd (and the per-sample file fds) per /proc/PID/task/TID alive across
+// samples, so a stat/syscall/wchan read is one pread() instead of a path walk through procfs.
+// entries are keyed by pid+tid and validated with starttime (field 22 of stat) so that a
+// reused pid is detected and the stale fds are reopened against the new task
+#define FDC_BUCKETS 4096
+
+struct fdc_entry {
+    int pid;
+    int tid;                       // tid == 0 for process level /proc/PID entries
+    unsigned long long starttime;  // identity of the task behind the cached fds, 0 = not known yet
+    int dirfd;                     // /proc/PID or /proc/PID/task/TID
+    int statfd;                    // lazily opened per-sample files, pread() at offset 0
+    int syscallfd;
+    int wchanfd;
+    int stackfd;
+    int schedstatfd;
+    unsigned int gen;              // sample generation this entry was last used in, for eviction
+    char comm[20];                 // comm at cache fill time, a change signals the task exec'd
+    char *exe;                     // cached exe basename (exe/cmdline are stable for a pid
+    char *cmdline;                 // lifetime, so they are re-read only after an exec)
+    unsigned long long prev_cputicks;  // utime+stime at the previous sample (cputime column)
+    unsigned long long prev_minflt;    // fault counters at the previous sample (flt columns)
+    unsigned long long prev_majflt;
+    int prev_counters_valid;           // 0 until the task has been sampled once
+    unsigned long long prev_sched_cpu; // schedstat cumulative on-cpu and runqueue-wait
+    unsigned long long prev_sched_wait;// nanoseconds at the previous sample (schedstat columns)
+    long long prev_sched_ms;           // when that previous schedstat read happened
+    int prev_sched_valid;
+    unsigned int delta_sig;            // --delta: hash of the last written tuple
+    unsigned int delta_cnt;            // samples suppressed since the last written row
+    char *delta_row;                   // last written row body (after the timestamp,
+    int delta_rowlen;                  // before the SAMPLES column), for the change flush
+    struct fdc_entry *next;
+};
+
+struct fdc_bucket {
+    struct fdc_entry *head;
+    pthread_mutex_t lock;          // list manipulation only, entries are used by one worker at a time
+};
+
+struct fdc_bucket fdc[FDC_BUCKETS];
+unsigned int fdc_gen = 0;          // bumped once per sample by main()
+
+unsigned int fdc_hash(int pid, int tid) {
+    return ((unsigned int) pid * 31 + (unsigned int) tid) & (FDC_BUCKETS - 1);
+}
+
+// non-destructive peek at one stat field (nf >= 3), for callers that must not tokenize
+// the buffer (fd cache validation, io_uring batch phases). same field walk as statindex()
+const char *stat_field(const char *statline, int nf) {
+    const char *p = strrchr(statline, ')');
+    int f;
+
+    if (!p || p[1] != ' ') return NULL;
+    p += 2;
+    for (f = 3; f < nf && p; f++) {
+        p = strchr(p, ' ');
+        if (p) p++;
+    }
+    return p;
+}
+
+// parse starttime (field 22) out of a stat line, the fd cache task identity check
+unsigned long long stat_starttime(const char *statline) {
+    const char *p = stat_field(statline, 22);
+    return p ? strtoull(p, NULL, 10) : 0;
+}
+
+// tokenize a stat line into a field index in one pass (modifies the buffer in place)
+int statindex(char *statline, struct statidx *ix) {
+    char *lp = strchr(statline, '(');
+    char *rp = strrchr(statline, ')');
+    char *p;
+    int nf;
+
+    memset(ix->f, 0, sizeof(ix->f));
+    ix->n = 0;
+    ix->state = 0;
+    if (!lp || !rp || rp[1] != ' ' || lp >= rp || lp == statline) return -1;
+
+    ix->f[1] = statline;
+    *(lp - 1) = 0;      // terminate pid
+    ix->f[2] = lp;      // "(comm)" with the parens, possibly containing spaces
+    *(rp + 1) = 0;      // terminate comm after the closing paren
+    p = rp + 2;
+
+    nf = 3;
+    while (*p && nf <= STAT_MAXFIELDS) {
+        ix->f[nf++] = p;
+        while (*p && *p != ' ' && *p != '\n') p++;
+        if (*p) *p++ = 0;
+    }
+    ix->n = nf - 1;
+    if (ix->n < 3) return -1;
+    ix->state = ix->f[3][0];
+    return 0;
+}
+
+void fdc_close_fds(struct fdc_entry *e) {
+    if (e->dirfd    != -1) close(e->dirfd);
+    if (e->statfd   != -1) close(e->statfd);
+    if (e->syscallfd!= -1) close(e->syscallfd);
+    if (e->wchanfd  != -1) close(e->wchanfd);
+    if (e->stackfd  != -1) close(e->stackfd);
+    if (e->schedstatfd != -1) close(e->schedstatfd);
+    e->dirfd = e->statfd = e->syscallfd = e->wchanfd = e->stackfd = e->schedstatfd = -1;
+}
+
+void fdc_close_entry(struct fdc_entry *e) {
+    free(e->exe);
+    free(e->cmdline);
+    free(e->delta_row);
+    fdc_close_fds(e);
+    free(e);
+}
+
+// entries deleted mid-sample (readfile() detecting pid reuse) are only unlinked and
+// their fds closed - the sampling code may still hold a pointer to the entry for the
+// rest of the current task, so the memory is parked here and freed in fdc_evict()
+struct fdc_entry *fdc_graveyard = NULL;
+pthread_mutex_t fdc_grave_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// find or create the cache entry for a task. returns NULL if the task is already gone
+struct fdc_entry *fdc_lookup(int pid, int tid) {
+    struct fdc_bucket *b = &fdc[fdc_hash(pid, tid)];
+    struct fdc_entry *e;
+    char path[64];
+    int dirfd;
+
+    pthread_mutex_lock(&b->lock);
+    for (e = b->head; e; e = e->next) {
+        if (e->pid == pid && e->tid == tid) {
+            e->gen = fdc_gen;
+            pthread_mutex_unlock(&b->lock);
+            return e;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+
+    tid ? sprintf(path, "%s/%d/task/%d", procfs_root, pid, tid) : sprintf(path, "%s/%d", procfs_root, pid);
+    dirfd = open(path, O_RDONLY | O_DIRECTORY);
+    if (dirfd == -1) {
+        if (DEBUG) fprintf(stderr, "error opening dir %s\n", path);
+        return NULL;
+    }
+
+    e = malloc(sizeof(struct fdc_entry));
+    if (!e) { close(dirfd); return NULL; }
+    e->pid = pid;
+    e->tid = tid;
+    e->starttime = 0;
+    e->dirfd = dirfd;
+    e->statfd = e->syscallfd = e->wchanfd = e->stackfd = e->schedstatfd = -1;
+    e->comm[0] = 0;
+    e->exe = e->cmdline = NULL;
+    e->prev_cputicks = e->prev_minflt = e->prev_majflt = 0;
+    e->prev_counters_valid = 0;
+    e->prev_sched_cpu = e->prev_sched_wait = 0;
+    e->prev_sched_ms = 0;
+    e->prev_sched_valid = 0;
+    e->delta_sig = e->delta_cnt = 0;
+    e->delta_row = NULL;
+    e->delta_rowlen = 0;
+    e->gen = fdc_gen;
+
+    pthread_mutex_lock(&b->lock);
+    e->next = b->head;
+    b->head = e;
+    pthread_mutex_unlock(&b->lock);
+    return e;
+}
+
+// unlink and close one entry (pid reuse or read error detected mid-sample)
+void fdc_del(struct fdc_entry *victim) {
+    struct fdc_bucket *b = &fdc[fdc_hash(victim->pid, victim->tid)];
+    struct fdc_entry **pp;
+
+    pthread_mutex_lock(&b->lock);
+    for (pp = &b->head; *pp; pp = &(*pp)->next) {
+        if (*pp == victim) {
+            *pp = victim->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+
+    fdc_close_fds(victim);
+    pthread_mutex_lock(&fdc_grave_lock);
+    victim->next = fdc_graveyard;
+    fdc_graveyard = victim;
+    pthread_mutex_unlock(&fdc_grave_lock);
+}
+
+// close entries for tasks that were not seen during the latest sample (they have exited).
+// called from main() between samples, no workers are running then
+void fdc_evict(void) {
+    struct fdc_entry **pp, *e;
+    int i;
+
+    for (i = 0; i < FDC_BUCKETS; i++) {
+        pp = &fdc[i].head;
+        while ((e = *pp)) {
+            if (e->gen != fdc_gen) {
+                *pp = e->next;
+                fdc_close_entry(e);
+            }
+            else {
+                pp = &e->next;
+            }
+        }
+    }
+
+    while ((e = fdc_graveyard)) { // no pointers to these can survive across samples
+        fdc_graveyard = e->next;
+        fdc_close_entry(e);
+    }
+}
+
+// uid for the USERNAME column: fstat() on the cached dirfd instead of a path-resolving
+// stat("/proc/PID") - and the fd identity check means the uid belongs to the same task
+// the subsequent reads see, closing the old stat-vs-read TOCTOU window
+uid_t fdc_uid(int pid) {
+    struct fdc_entry *e = fdc_lookup(pid, 0);
+    struct stat st;
+
+    if (!e || fstat(e->dirfd, &st)) return -1;
+    return st.st_uid;
+}
+
+// map a per-sample file name to its cached fd slot, NULL for files read via plain openat()
+int *fdc_slot(struct fdc_entry *e, const char *name) {
+    switch (name[0]) {
+        case 's':
+            if (name[1] == 't' && name[2] == 'a' && name[3] == 't' && !name[4]) return &e->statfd;
+            if (name[1] == 'y') return &e->syscallfd;
+            if (name[1] == 't') return &e->stackfd;
+            if (name[1] == 'c') return &e->schedstatfd;
+            break;
+        case 'w':
+            return &e->wchanfd;
+    }
+    return NULL;
+}
+
+// -c schedstat: the native replacement for the per-PID bin/schedlat python loop.
+// /proc/PID/task/TID/schedstat holds cumulative on-cpu and runqueue-wait nanoseconds,
+// the deltas against this task's previous sample become CPU% and LAT% of the wall
+// time in between, in tenths of a percent (1000 = 100%). returns 0 and leaves the
+// outputs alone on the first sighting, when there is nothing to diff against yet
+int schedstat_pct10(struct fdc_entry *e, const char *buf, long long *cpu10, long long *lat10) {
+    char *p = (char *) buf;
+    unsigned long long cpu_ns = strtoull(buf, &p, 10);
+    unsigned long long wait_ns = strtoull(p, NULL, 10);
+    long long wall_ns = (sample_ts_ms - e->prev_sched_ms) * 1000000LL;
+    int have_prev = e->prev_sched_valid && wall_ns > 0;
+
+    if (have_prev) {
+        *cpu10 = (long long) (cpu_ns - e->prev_sched_cpu) * 1000 / wall_ns;
+        *lat10 = (long long) (wait_ns - e->prev_sched_wait) * 1000 / wall_ns;
+        if (*cpu10 < 0) *cpu10 = 0; // counters can reset when a pid gets recycled
+        if (*lat10 < 0) *lat10 = 0;
+    }
+    e->prev_sched_cpu = cpu_ns;
+    e->prev_sched_wait = wait_ns;
+    e->prev_sched_ms = sample_ts_ms;
+    e->prev_sched_valid = 1;
+    return have_prev;
+}
+
+// live process set for --tasklist=netlink: instead of re-walking all of /proc every sample,
+// subscribe to the proc connector and apply FORK/EXIT events to an in-memory table, so a
+// sample just iterates an already-built pid array. a periodic full rescan reconciles drift
+// (lost netlink messages). only process level pids are tracked here, threads of
+// multithreaded processes keep being enumerated from /proc/PID/task during the sample
+
+#define PIDSET_MINCAP 4096
+#define TASKLIST_RESCAN 60   // full /proc reconciliation rescan every this many samples
+
+int *pidset_tab = NULL;      // open addressing hash of live pids (0 = empty slot)
+unsigned pidset_cap = 0;
+int *pidset_arr = NULL;      // dense iteration array, kept in sync with the hash
+int pidset_n = 0;
+int pidset_arr_cap = 0;
+
+unsigned pidset_slotof(int pid) {
+    unsigned h = (unsigned) pid * 2654435761u & (pidset_cap - 1);
+    while (pidset_tab[h] && pidset_tab[h] != pid)
+        h = (h + 1) & (pidset_cap - 1);
+    return h;
+}
+
+void pidset_add(int pid);
+
+void pidset_growtab(void) {
+    int *oldarr = pidset_arr;
+    int oldn = pidset_n;
+    int i;
+
+    pidset_cap = pidset_cap ? pidset_cap * 2 : PIDSET_MINCAP;
+    free(pidset_tab);
+    pidset_tab = calloc(pidset_cap, sizeof(int));
+    if (!pidset_tab) { fprintf(stderr, "out of memory allocating pid set\n"); exit(1); }
+    // re-insert the dense array into the fresh hash
+    pidset_arr = NULL;
+    pidset_n = 0;
+    pidset_arr_cap = 0;
+    for (i = 0; i < oldn; i++)
+        pidset_add(oldarr[i]);
+    free(oldarr);
+}
+
+void pidset_add(int pid) {
+    unsigned h;
+
+    if (pid <= 0) return;
+    if (!pidset_cap || (unsigned) pidset_n * 10 >= pidset_cap * 7)
+        pidset_growtab();
+    h = pidset_slotof(pid);
+    if (pidset_tab[h] == pid) return; // already tracked
+    pidset_tab[h] = pid;
+    if (pidset_n == pidset_arr_cap) {
+        pidset_arr_cap = pidset_arr_cap ? pidset_arr_cap * 2 : PIDSET_MINCAP;
+        pidset_arr = realloc(pidset_arr, pidset_arr_cap * sizeof(int));
+        if (!pidset_arr) { fprintf(stderr, "out of memory allocating pid set\n"); exit(1); }
+    }
+    pidset_arr[pidset_n++] = pid;
+}
+
+void pidset_del(int pid) {
+    unsigned h, nh;
+    int i, moved;
+
+    if (!pidset_cap) return;
+    h = pidset_slotof(pid);
+    if (pidset_tab[h] != pid) return;
+    pidset_tab[h] = 0;
+    // re-insert the rest of the collision run so lookups keep working
+    nh = (h + 1) & (pidset_cap - 1);
+    while (pidset_tab[nh]) {
+        moved = pidset_tab[nh];
+        pidset_tab[nh] = 0;
+        pidset_tab[pidset_slotof(moved)] = moved;
+        nh = (nh + 1) & (pidset_cap - 1);
+    }
+    // the dense array is small relative to sampling work, linear removal is fine here
+    for (i = 0; i < pidset_n; i++) {
+        if (pidset_arr[i] == pid) {
+            pidset_arr[i] = pidset_arr[--pidset_n];
+            break;
+        }
+    }
+}
+
+void pidset_clear(void) {
+    if (pidset_tab) memset(pidset_tab, 0, pidset_cap * sizeof(int));
+    pidset_n = 0;
+}
+
+// --tiered adaptive sampling: most tasks sleep sample after sample and are excluded
+// by the state filter only after their stat file was already read. a per-pid history
+// demotes processes with no emitted rows for K consecutive samples to a slow tier
+// that is only re-checked every Nth interval, and promotes them back on the first
+// observed activity - the hot minority keeps full-rate fidelity while the idle
+// majority costs (almost) nothing. hash buckets with their own locks like the kernel
+// stack cache, since -j workers stamp activity concurrently with each emitted row
+int tiered_k = 0;   // --tiered: demote after this many fully idle samples, 0 = mode off
+int tiered_n = 0;   // demoted processes get re-checked every Nth sample
+
+#define TIER_BUCKETS 1024
+
+struct tier_entry {
+    int pid;
+    int idle_streak;          // consecutive samples with zero emitted rows (hot tier)
+    int countdown;            // samples until the next check, 0 = hot tier
+    unsigned int sched_gen;   // last sample generation this pid was scheduled in
+    unsigned int active_gen;  // last generation a row of this pid was emitted in
+    unsigned int gen;         // last generation this entry was consulted, for eviction
+    struct tier_entry *next;
+};
+
+struct tier_bucket {
+    struct tier_entry *head;
+    pthread_mutex_t lock;
+};
+
+struct tier_bucket tiertab[TIER_BUCKETS];
+
+// a row of this pid made it through the state filter - stamp the generation so the
+// scheduling decision of the next sample sees the activity. called by the sampling
+// threads, a missing entry just means tiering is off or the entry was swept
+void tier_mark_active(int pid) {
+    struct tier_bucket *bk = &tiertab[(unsigned int) pid % TIER_BUCKETS];
+    struct tier_entry *e;
+
+    if (!tiered_k) return;
+    pthread_mutex_lock(&bk->lock);
+    for (e = bk->head; e; e = e->next)
+        if (e->pid == pid) { e->active_gen = fdc_gen; break; }
+    pthread_mutex_unlock(&bk->lock);
+}
+
+// main() asks once per pid per sample: settle what happened in the previous round,
+// then decide whether this pid gets sampled now. returns 0 to skip (slow tier)
+int tier_check(int pid) {
+    struct tier_bucket *bk = &tiertab[(unsigned int) pid % TIER_BUCKETS];
+    struct tier_entry *e;
+    int sample;
+
+    pthread_mutex_lock(&bk->lock);
+    for (e = bk->head; e; e = e->next)
+        if (e->pid == pid) break;
+    if (!e) {
+        e = calloc(1, sizeof(struct tier_entry));
+        if (!e) { pthread_mutex_unlock(&bk->lock); return 1; }
+        e->pid = pid;
+        e->next = bk->head;
+        bk->head = e;
+    }
+    e->gen = fdc_gen;
+
+    if (e->sched_gen == fdc_gen - 1) { // it was sampled last round, was it active?
+        if (e->active_gen == e->sched_gen) {
+            e->idle_streak = 0;
+            e->countdown = 0;
+        }
+        else {
+            if (e->idle_streak < tiered_k) e->idle_streak++;
+            if (e->idle_streak >= tiered_k) e->countdown = tiered_n;
+        }
+    }
+
+    if (e->countdown) e->countdown--;
+    sample = !e->countdown;
+    if (sample) e->sched_gen = fdc_gen;
+    pthread_mutex_unlock(&bk->lock);
+    return sample;
+}
+
+// drop history of pids that no longer show up in the task listing. called between
+// samples, right after the listing consulted every live pid
+void tier_sweep(void) {
+    struct tier_entry *e, **prev;
+    int i;
+
+    for (i = 0; i < TIER_BUCKETS; i++) {
+        pthread_mutex_lock(&tiertab[i].lock);
+        prev = &tiertab[i].head;
+        while ((e = *prev)) {
+            if (e->gen != fdc_gen) {
+                *prev = e->next;
+                free(e);
+            }
+            else
+                prev = &e->next;
+        }
+        pthread_mutex_unlock(&tiertab[i].lock);
+    }
+}
+
+// --cgroup: the tasklist comes from a handful of small cgroup.procs reads instead of
+// the global /proc readdir - on a 50k-task node sampling one tenant's 300 tasks then
+// costs what 300 tasks cost. child cgroups are walked recursively, and only processes
+// are listed here (sampleprocess() enumerates each one's threads as usual)
+void cgroup_listpids(const char *dir) {
+
+    char path[PATH_MAX];
+    FILE *f;
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    int pid;
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", dir);
+    f = fopen(path, "r");
+    if (f) {
+        while (fscanf(f, "%d", &pid) == 1)
+            pidset_add(pid);
+        fclose(f);
+    }
+
+    d = opendir(dir);
+    if (!d) return;
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.') continue;
+        if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, de->d_name) >= (int) sizeof(path)) continue;
+        if (de->d_type == DT_UNKNOWN && (stat(path, &st) || !S_ISDIR(st.st_mode))) continue;
+        cgroup_listpids(path);
+    }
+    closedir(d);
+}
+
+// proc connector subscription (requires root / CAP_NET_ADMIN)
+int cn_sock = -1;
+
+int cn_connect(void) {
+    struct sockaddr_nl sa;
+    struct {
+        struct nlmsghdr nl_hdr;
+        struct cn_msg cn;
+        enum proc_cn_mcast_op op;
+    } __attribute__((packed)) msg;
+
+    cn_sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_CONNECTOR);
+    if (cn_sock == -1) return -1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = CN_IDX_PROC;
+    sa.nl_pid = getpid();
+    if (bind(cn_sock, (struct sockaddr *) &sa, sizeof(sa))) { close(cn_sock); cn_sock = -1; return -1; }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.nl_hdr.nlmsg_len = sizeof(msg);
+    msg.nl_hdr.nlmsg_pid = getpid();
+    msg.nl_hdr.nlmsg_type = NLMSG_DONE;
+    msg.cn.id.idx = CN_IDX_PROC;
+    msg.cn.id.val = CN_VAL_PROC;
+    msg.cn.len = sizeof(enum proc_cn_mcast_op);
+    msg.op = PROC_CN_MCAST_LISTEN;
+    if (send(cn_sock, &msg, sizeof(msg), 0) != sizeof(msg)) { close(cn_sock); cn_sock = -1; return -1; }
+
+    return 0;
+}
+
+// apply all queued fork/exit events to the pid set, called right before each sample
+void cn_drain(void) {
+    char buf[8192];
+    ssize_t len;
+    struct nlmsghdr *nlh;
+    struct proc_event *ev;
+
+    while ((len = recv(cn_sock, buf, sizeof(buf), 0)) > 0) {
+        for (nlh = (struct nlmsghdr *) buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+            if (nlh->nlmsg_type != NLMSG_DONE) continue;
+            ev = (struct proc_event *) ((struct cn_msg *) NLMSG_DATA(nlh))->data;
+            switch (ev->what) {
+                case PROC_EVENT_FORK:
+                    // new process only: new threads are found via the /proc/PID/task walk
+                    if (ev->event_data.fork.child_pid == ev->event_data.fork.child_tgid)
+                        pidset_add(ev->event_data.fork.child_tgid);
+                    break;
+                case PROC_EVENT_EXIT:
+                    if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+                        pidset_del(ev->event_data.exit.process_tgid);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+#ifdef HAVE_URING
+
+// minimal raw io_uring wrapper (no liburing dependency): we only ever queue IORING_OP_READ
+// of already-open fd cache fds at offset 0, submit the whole wave and wait for everything.
+// each sampling thread owns its own ring, so no locking is needed here
+#define URING_ENTRIES 512
+
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned entries;
+    unsigned pending;      // queued but not yet reaped
+};
+
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int uring_init(struct uring *u) {
+    struct io_uring_params p;
+    size_t sqsz, cqsz;
+    void *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (u->fd < 0) return -1;
+
+    sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqsz = p.cq_off.cqes  + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cqsz > sqsz) sqsz = cqsz;
+        cqsz = sqsz;
+    }
+
+    sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) { close(u->fd); return -1; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    }
+    else {
+        cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) { close(u->fd); return -1; }
+    }
+
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) { close(u->fd); return -1; }
+
+    u->sq_head  = (unsigned *) ((char *) sq + p.sq_off.head);
+    u->sq_tail  = (unsigned *) ((char *) sq + p.sq_off.tail);
+    u->sq_mask  = (unsigned *) ((char *) sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *) ((char *) sq + p.sq_off.array);
+    u->cq_head  = (unsigned *) ((char *) cq + p.cq_off.head);
+    u->cq_tail  = (unsigned *) ((char *) cq + p.cq_off.tail);
+    u->cq_mask  = (unsigned *) ((char *) cq + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *) ((char *) cq + p.cq_off.cqes);
+    u->entries  = p.sq_entries;
+    u->pending  = 0;
+    return 0;
+}
+
+// submit everything queued so far and wait until all completions have been reaped.
+// each cqe's user_data points at the int result slot of the read it belongs to
+int uring_drain(struct uring *u) {
+    unsigned head, tail, reaped = 0;
+    struct io_uring_cqe *cqe;
+    int *resslot;
+
+    if (!u->pending) return 0;
+
+    if (sys_io_uring_enter(u->fd, u->pending, u->pending, IORING_ENTER_GETEVENTS) < 0) {
+        if (DEBUG) fprintf(stderr, "io_uring_enter error='%s'\n", strerror(errno));
+        return -1;
+    }
+
+    while (reaped < u->pending) {
+        head = *u->cq_head;
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            cqe = &u->cqes[head & *u->cq_mask];
+            resslot = (int *) (unsigned long) cqe->user_data;
+            *resslot = cqe->res;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+        if (reaped < u->pending &&
+            sys_io_uring_enter(u->fd, 0, u->pending - reaped, IORING_ENTER_GETEVENTS) < 0)
+            return -1;
+    }
+    u->pending = 0;
+    return 0;
+}
+
+// queue one pread-at-0 of an fd cache fd, draining first if the sq ring is full
+int uring_queue_read(struct uring *u, int fd, char *buf, unsigned len, int *resslot) {
+    unsigned tail, idx;
+    struct io_uring_sqe *sqe;
+
+    if (u->pending == u->entries && uring_drain(u)) return -1;
+
+    tail = *u->sq_tail;
+    idx = tail & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->off = 0;
+    sqe->user_data = (unsigned long) resslot;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->pending++;
+    return 0;
+}
+
+#endif // HAVE_URING
+
+// normalize a raw read() result the same way readfile() does: errors and empty
+// reads come back as "-", short and full buffers get their terminator fixed up
+int fixreadbuf(char *buf, int bytes) {
+    switch (bytes) {
+        case -1:
+        case 0:
+            buf[0] = '-';
+            buf[1] = 0;
+            return 2;
+        case 1:
+            buf[1] = 0;
+            return 2;
+        default:
+            if (bytes < MAXFILEBUF)
+                buf[bytes] = 0;
+            else
+                buf[MAXFILEBUF-1] = 0;
+            return bytes;
+    }
+}
+
+int readfile_raw(int pid, int tid, const char *name, char *buf)
+{
+    int fd, bytes = 0;
+    int *slot;
+    int retried = 0;
+    unsigned long long starttime;
+    struct fdc_entry *e;
+
+retry:
+    e = fdc_lookup(pid, tid);
+    if (!e) return -1;
+
+    slot = fdc_slot(e, name);
+    if (slot) {
+        if (*slot == -1) *slot = openat(e->dirfd, name, O_RDONLY);
+        fd = *slot;
+        if (fd == -1) {
+            if (DEBUG) fprintf(stderr, "error opening file %s for pid=%d tid=%d\n", name, pid, tid);
+            return -1;
+        }
+        bytes = pread(fd, buf, MAXFILEBUF, 0);
+        if (bytes == -1) { // task likely exited under us, drop the stale fds
+            fdc_del(e);
+            return -1;
+        }
+    }
+    else { // not a per-sample hot file (cmdline etc), open relative to the cached dirfd
+        fd = openat(e->dirfd, name, O_RDONLY);
+        if (fd == -1) {
+            if (DEBUG) fprintf(stderr, "error opening file %s for pid=%d tid=%d\n", name, pid, tid);
+            return -1;
+        }
+        bytes = read(fd, buf, MAXFILEBUF);
+        close(fd);
+    }
+   
+    // handle errors, empty records and missing string terminators in input
+    assert(bytes >= -1);
+    if (bytes == -1 && DEBUG) fprintf(stderr, "read(%s) returned %d\n", name, bytes);
+    bytes = fixreadbuf(buf, bytes);
+
+    // validate the cached fds still belong to the same task (pid values get reused)
+    if (slot == &e->statfd && bytes > 2) {
+        starttime = stat_starttime(buf);
+        if (!e->starttime) {
+            e->starttime = starttime;
+        }
+        else if (starttime != e->starttime) {
+            fdc_del(e);
+            if (!retried) { retried = 1; goto retry; }
+            return -1;
+        }
+    }
+
+    return bytes;
+}
+
+int readfile(int pid, int tid, const char *name, char *buf)
+{
+    unsigned long long t0;
+    int bytes;
+
+    if (!stats_every) return readfile_raw(pid, tid, name, buf);
+    t0 = stats_now_us();
+    bytes = readfile_raw(pid, tid, name, buf);
+    phist_add(stats_phase(name), stats_now_us() - t0);
+    return bytes;
+}
+
+// kernel stack interning cache: tasks blocked at the same wait point produce byte
+// identical /proc/PID/stack text (a host full of workers in the same futex or
+// io_schedule stack is the common case), so the formatted "->func()" form of each
+// distinct raw stack is kept keyed by a hash of the raw bytes. a repeated stack then
+// costs one hash lookup and one memcpy instead of a full reparse. the entry cap is a
+// safety net against pathologically unique stacks, beyond it stacks still print but
+// are no longer cached
+#define STKC_BUCKETS 1024
+#define STKC_MAXENTRIES 8192
+
+struct stkc_entry {
+    unsigned int hash;
+    int rawlen;
+    char *raw;               // raw stack text, compared on hash collision
+    char *fmt;               // formatted "->func()->func()" output string
+    int fmtlen;
+    struct stkc_entry *next;
+};
+
+struct stkc_bucket {
+    struct stkc_entry *head;
+    pthread_mutex_t lock;
+};
+
+struct stkc_bucket stkc[STKC_BUCKETS];
+int stkc_entries = 0;  // approximate under concurrent workers, only guards the cap
+
+unsigned int stkc_hash(const char *buf, int len) {
+    unsigned int h = 2166136261u;  // FNV-1a
+    int i;
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) buf[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+#define STACK_MAXFRAMES 128
+
+// helper for skipping uninteresting stack frames below, avoids strlen on literals
+#define frame_is(name, n, literal) ((n) == sizeof(literal) - 1 && !memcmp((name), (literal), (n)))
+
+int outputstack(struct obuf *ob, char *str) {
+
+    // extract the function name from each stack line in a single forward pass, letting
+    // memchr (vectorized in libc) jump between the delimiters instead of the old
+    // byte-at-a-time backward scan over the whole buffer.
+    // example input lines (different number of fields): 
+    //    [<ffffffff8528428c>] vfs_read+0x8c/0x130
+    //    [<ffffffffc03b03f4>] xfs_file_fsync+0x224/0x240 [xfs]
+    char *frames[STACK_MAXFRAMES];
+    int framelen[STACK_MAXFRAMES];
+    int nframes = 0, i, n;
+    char *p = str, *end = str + strlen(str);
+    char *nl, *br, *name, *stop;
+
+    while (p < end && nframes < STACK_MAXFRAMES) {
+        nl = memchr(p, '\n', end - p);
+        if (!nl) nl = end;
+        br = memchr(p, ']', nl - p);
+        if (br && br[1] == ' ') {
+            name = br + 2;
+            stop = memchr(name, '+', nl - name); // no +offset suffix on the outermost frame
+            if (!stop) stop = nl;
+            n = stop - name;
+            if (n > 0 &&
+                !frame_is(name, n, "entry_SYSCALL_64_after_hwframe") &&
+                !frame_is(name, n, "do_syscall_64") &&
+                !frame_is(name, n, "0xffffffffffffffff")) {
+                frames[nframes] = name;
+                framelen[nframes] = n;
+                nframes++;
+            }
+        }
+        p = nl + 1;
+    }
+
+    // emit outermost frame first, as the old reverse scan did
+    for (i = nframes - 1; i >= 0; i--) {
+        ob_str(ob, "->");
+        ob_mem(ob, frames[i], framelen[i]);
+        ob_str(ob, "()");
+    }
+    return 0;
+}
+
+// kstack emission through the interning cache: serve a known stack straight from the
+// cache, otherwise format it into the output arena as usual and remember the result
+void outputstack_interned(struct obuf *ob, char *str, int rawlen) {
+
+    unsigned int h = stkc_hash(str, rawlen);
+    struct stkc_bucket *bk = &stkc[h % STKC_BUCKETS];
+    struct stkc_entry *e;
+    size_t mark;
+
+    pthread_mutex_lock(&bk->lock);
+    for (e = bk->head; e; e = e->next) {
+        if (e->hash == h && e->rawlen == rawlen && !memcmp(e->raw, str, rawlen)) {
+            ob_mem(ob, e->fmt, e->fmtlen);
+            pthread_mutex_unlock(&bk->lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&bk->lock);
+
+    mark = ob->len;
+    outputstack(ob, str);  // does not modify str, the raw bytes stay valid as the key
+
+    if (stkc_entries >= STKC_MAXENTRIES) return;
+    e = malloc(sizeof(struct stkc_entry));
+    if (!e) return;
+    e->hash = h;
+    e->rawlen = rawlen;
+    e->fmtlen = ob->len - mark;
+    e->raw = malloc(rawlen);
+    e->fmt = malloc(e->fmtlen);
+    if (!e->raw || !e->fmt) { free(e->raw); free(e->fmt); free(e); return; }
+    memcpy(e->raw, str, rawlen);
+    memcpy(e->fmt, ob->buf + mark, e->fmtlen);
+
+    // a concurrent worker may have interned the same stack meanwhile, a rare duplicate
+    // entry wastes a little memory but stays correct (lookups stop at the first match)
+    pthread_mutex_lock(&bk->lock);
+    e->next = bk->head;
+    bk->head = e;
+    stkc_entries++;
+    pthread_mutex_unlock(&bk->lock);
+}
+
+// -F binary output: compact columnar records for the -o path. repeated strings
+// (usernames, comm, syscall and wchan names, exe, cmdline, formatted kstacks) dominate
+// the CSV files, so string columns are dictionary encoded per output file and written
+// inline as tagged dictionary records the first time they appear. the exact record
+// layout lives in include/xcapture_binfmt.h, bin/xcsv renders files back into CSV
+#define DICT_BUCKETS 4096
+
+struct dict_entry {
+    char *str;
+    unsigned int id;
+    unsigned int hash;
+    struct dict_entry *next;
+    struct dict_entry *added_next; // entries interned since the last accepted flush
+};
+
+struct dict_entry *dict[DICT_BUCKETS];
+struct dict_entry *dict_added = NULL; // head of the not-yet-flushed chain
+unsigned int dict_nextid = 0;
+pthread_mutex_t dict_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// raw native-order scalar appends for the binary records
+void ob_bin16(struct obuf *ob, unsigned short v)     { ob_mem(ob, &v, 2); }
+void ob_bin32(struct obuf *ob, unsigned int v)       { ob_mem(ob, &v, 4); }
+void ob_bin64(struct obuf *ob, unsigned long long v) { ob_mem(ob, &v, 8); }
+
+// look up (or intern) a string, emitting its dictionary record into this thread's
+// arena on first sighting. when a concurrent worker wins the intern race a row can
+// precede the dictionary record it references in the stitched file - xcsv collects
+// the whole dictionary before rendering rows, so the ordering does not matter
+unsigned int dict_intern(struct obuf *ob, const char *str) {
+
+    int len = strlen(str);
+    unsigned int h = stkc_hash(str, len);
+    struct dict_entry *e;
+    unsigned int id;
+
+    pthread_mutex_lock(&dict_lock);
+    for (e = dict[h % DICT_BUCKETS]; e; e = e->next) {
+        if (e->hash == h && !strcmp(e->str, str)) {
+            pthread_mutex_unlock(&dict_lock);
+            return e->id;
+        }
+    }
+    e = malloc(sizeof(struct dict_entry));
+    if (!e) { pthread_mutex_unlock(&dict_lock); return 0; }
+    e->str = strdup(str);
+    e->hash = h;
+    e->id = id = dict_nextid++;
+    e->next = dict[h % DICT_BUCKETS];
+    dict[h % DICT_BUCKETS] = e;
+    e->added_next = dict_added;
+    dict_added = e;
+    pthread_mutex_unlock(&dict_lock);
+
+    ob_putc(ob, XCAP_TAG_DICT);
+    ob_bin32(ob, id);
+    ob_bin16(ob, len);
+    ob_mem(ob, str, len);
+    return id;
+}
+
+// ids restart from 0 for every output file, called at rotation (no workers in flight)
+void dict_clear(void) {
+    struct dict_entry *e, *next;
+    int i;
+    for (i = 0; i < DICT_BUCKETS; i++) {
+        for (e = dict[i]; e; e = next) {
+            next = e->next;
+            free(e->str);
+            free(e);
+        }
+        dict[i] = NULL;
+    }
+    dict_added = NULL;
+    dict_nextid = 0;
+}
+
+// the sample that carried the first-sighting records of the recently interned strings
+// made it to the writer - they are part of the file now, stop tracking them
+void dict_commit(void) {
+    pthread_mutex_lock(&dict_lock);
+    dict_added = NULL;
+    pthread_mutex_unlock(&dict_lock);
+}
+
+// the writer dropped that sample instead, taking the new dictionary records with it:
+// un-intern the strings so the next reference emits a fresh record into a buffer that
+// does land on disk. the dropped ids simply stay unused (readers treat ids as sparse
+// keys), and every row referencing them was dropped with the same buffer. called from
+// flushsample with no workers in flight
+void dict_rollback(void) {
+    struct dict_entry *e, **pp;
+    pthread_mutex_lock(&dict_lock);
+    while ((e = dict_added)) {
+        dict_added = e->added_next;
+        for (pp = &dict[e->hash % DICT_BUCKETS]; *pp != e; pp = &(*pp)->next)
+            ;
+        *pp = e->next;
+        free(e->str);
+        free(e);
+    }
+    pthread_mutex_unlock(&dict_lock);
+}
+
+unsigned short bin_colflags(char *add_columns) {
+    unsigned short f = 0;
+    if (strcasestr(add_columns, "exe"))     f |= XCAP_COL_EXE;
+    if (strcasestr(add_columns, "cmdline")) f |= XCAP_COL_CMDLINE;
+    if (strcasestr(add_columns, "cputime")) f |= XCAP_COL_CPUTIME;
+    if (strcasestr(add_columns, "flt"))     f |= XCAP_COL_FLT;
+    if (strcasestr(add_columns, "rss"))     f |= XCAP_COL_RSS;
+    if (strcasestr(add_columns, "prio"))    f |= XCAP_COL_PRIO;
+    if (strcasestr(add_columns, "cpuid"))   f |= XCAP_COL_CPUID;
+    if (strcasestr(add_columns, "kstack"))  f |= XCAP_COL_KSTACK;
+    if (strcasestr(add_columns, "schedstat")) f |= XCAP_COL_SCHED;
+    return f;
+}
+
+void bin_filehdr(struct obuf *ob, char *add_columns) {
+    ob_mem(ob, XCAP_BIN_MAGIC, 4);
+    ob_bin16(ob, XCAP_BIN_VERSION);
+    ob_bin16(ob, bin_colflags(add_columns));
+}
+
+// this function changes the input str (tokenizes it in place)
+int outputfields(struct obuf *ob, char *str, char *mask, char *sep) {
+    int i;
+    char *field, *pos;
+    const char *scname;
+
+    // special case for stack trace handling, we don't want to split the input string before calling outputstack()
+    if (mask[0] == 't')
+        return outputstack(ob, str);
+
+    for (i=0; mask[i]; i++) { // no strlen(mask) per iteration
+        if ((field = strsep(&str, sep)) != NULL) {
+            switch (mask[i]) {
+                case '.': // skip field
+                    break;
+                case 'e': // extract Executable file name from full path
+                    pos = strrchr(field, '/');
+                    ob_str(ob, pos ? pos : field);
+                    ob_putc(ob, outsep);
+                    break;
+                case 'E': // same as above, but wider output
+                    pos = strrchr(field, '/');
+                    ob_field(ob, pos ? pos+1 : field, 20);
+                    break;
+                case 'o': // just output string as is
+                    ob_str(ob, field);
+                    ob_putc(ob, outsep);
+                    break;
+                case 'O': // just output string as is, padded to 25 chars
+                    ob_field(ob, field, 25);
+                    break;
+                case 'x': // print in hex
+                    ob_hex(ob, atoll(field));
+                    break;
+                case 's': // convert syscall number to name, the input starts with either:
+                          //  >= 0 (syscall), -1 (in kernel without syscall) or 'running' (likely userspace)
+                          // numbers past the arch table (or in its holes) print as the raw number
+                    scname = field[0]=='r' ? "[running]" : field[0]=='-' ? "[no_syscall]" : syscall_name(atoi(field));
+                    ob_str(ob, scname ? scname : field);
+                    ob_putc(ob, outsep);
+                    break;
+                case 'S': // same as above, but wider output
+                    scname = field[0]=='r' ? "[running]" : field[0]=='-' ? "[no_syscall]" : syscall_name(atoi(field));
+                    ob_field(ob, scname ? scname : field, 25);
+                    break;
+                case 't': // we shouldn't get here thanks to the if statement above
+                    break;
+                default:
+                    fprintf(stderr, "Error: Wrong char '%c' in mask %s\n", mask[i], mask); 
+                    exit(1);
+             }       
+        }
+        else break;
+    }
+
+    return i;
+}
+
+// --delta emission: a row is only written out when the task's sampled tuple (state,
+// syscall, wchan and, with -c kstack, the kernel stack) differs from the last row
+// written for that task. suppressed samples are counted into the task's fd cache
+// entry and reported in a trailing SAMPLES column - a keepalive row flushes the
+// count every N suppressed samples, and a tuple change flushes it as one extra row
+// stamped with the current sample time, so summing SAMPLES per tuple reconstructs
+// occupancy exactly (a task exiting mid-run loses at most N-1 unreported samples)
+int delta_keepalive = 0;    // --delta: keepalive after this many samples, 0 = mode off
+
+unsigned int delta_hash(const char *p, size_t n, unsigned int h) { // FNV-1a continuation
+    while (n--) {
+        h ^= (unsigned char) *p++;
+        h *= 16777619;
+    }
+    return h;
+}
+
+// currently a fixed string, will make this dynamic together with command line option support
+int outputheader(struct obuf *ob, char *add_columns) {
+
+    ob_field(ob, pad ? "DATE       TIME" : "TS", 23);
+    ob_rfield(ob, "PID", 7);
+    ob_rfield(ob, "TID", 7);
+    ob_field(ob, "USERNAME", 15);
+    ob_field(ob, "ST", 2);
+    ob_field(ob, "COMMAND", 25);
+    ob_field(ob, "SYSCALL", 25);
+    ob_field(ob, "WCHAN", 25);
+    if (strcasestr(add_columns, "exe"))     ob_field(ob, "EXE", 20);
+    if (strcasestr(add_columns, "cmdline")) ob_field(ob, "CMDLINE", 30);
+    if (strcasestr(add_columns, "cputime")) ob_rfield(ob, "CPUTICKS", 8);
+    if (strcasestr(add_columns, "flt"))   { ob_rfield(ob, "MINFLT", 8); ob_rfield(ob, "MAJFLT", 8); }
+    if (strcasestr(add_columns, "rss"))     ob_rfield(ob, "RSS", 10);
+    if (strcasestr(add_columns, "prio"))    ob_rfield(ob, "PRIO", 5);
+    if (strcasestr(add_columns, "cpuid"))   ob_rfield(ob, "CPU", 5);
+    if (strcasestr(add_columns, "schedstat")) { ob_rfield(ob, "CPU%", 6); ob_rfield(ob, "LAT%", 6); }
+    if (strcasestr(add_columns, "kstack"))  ob_field(ob, "KSTACK", 0);
+    if (delta_keepalive)                    ob_rfield(ob, "SAMPLES", 7);
+    ob->len--; // the header line carries no trailing separator, unlike the data rows
+    ob_putc(ob, '\n');
+    return 1;
+}
+
+// partial entry happens when /proc/PID/stat disappears before we manage to read it
+void outputprocpartial(struct capture_ctx *ctx, int pid, int tid, char *sampletime, uid_t proc_uid, char *add_columns, char *message) {
+
+    struct obuf *ob = &ctx->ob;
+    unsigned int dash_id;
+    unsigned short colflags;
+
+    if (ctx->print_header)
+        header_printed = header_printed ? 1 : outputheader(ob, add_columns);
+    ctx->emitted++;
+    if (tiered_k) tier_mark_active(pid); // disappeared mid-read counts as activity
+
+    if (output_format == 'B') { // all columns lost except the identity of the task
+        unsigned int uid_id, msg_id;
+        colflags = bin_colflags(add_columns);
+        // intern before starting the row so dictionary records don't split its framing
+        dash_id = dict_intern(ob, "-");
+        uid_id = dict_intern(ob, getusername(proc_uid));
+        msg_id = dict_intern(ob, message);
+        ob_putc(ob, XCAP_TAG_ROW);
+        ob_bin64(ob, (unsigned long long) sample_ts_ms);
+        ob_bin32(ob, pid);
+        ob_bin32(ob, tid);
+        ob_bin32(ob, uid_id);
+        ob_putc(ob, '-');
+        ob_bin32(ob, msg_id);
+        ob_bin32(ob, dash_id);
+        ob_bin32(ob, dash_id);
+        if (colflags & XCAP_COL_EXE)     ob_bin32(ob, dash_id);
+        if (colflags & XCAP_COL_CMDLINE) ob_bin32(ob, dash_id);
+        if (colflags & XCAP_COL_CPUTIME) ob_bin64(ob, XCAP_BIN_NOVAL);
+        if (colflags & XCAP_COL_FLT)   { ob_bin64(ob, XCAP_BIN_NOVAL); ob_bin64(ob, XCAP_BIN_NOVAL); }
+        if (colflags & XCAP_COL_RSS)     ob_bin64(ob, XCAP_BIN_NOVAL);
+        if (colflags & XCAP_COL_PRIO)    ob_bin64(ob, XCAP_BIN_NOVAL);
+        if (colflags & XCAP_COL_CPUID)   ob_bin64(ob, XCAP_BIN_NOVAL);
+        if (colflags & XCAP_COL_SCHED) { ob_bin64(ob, XCAP_BIN_NOVAL); ob_bin64(ob, XCAP_BIN_NOVAL); }
+        if (colflags & XCAP_COL_KSTACK)  ob_bin32(ob, dash_id);
+        return;
+    }
+
+    ob_field(ob, sampletime, 23);
+    ob_num(ob, pid, 7);
+    ob_num(ob, tid, 7);
+    ob_field(ob, getusername(proc_uid), 15);
+    ob_field(ob, "-", 2);
+    ob_field(ob, message, 25);
+    ob_field(ob, "-", 25);
+    ob_field(ob, "-", 25);
+    if (strcasestr(add_columns, "exe"))     ob_field(ob, "-", 20);
+    if (strcasestr(add_columns, "cmdline")) ob_field(ob, "-", 30);
+    if (strcasestr(add_columns, "cputime")) ob_rfield(ob, "-", 8);
+    if (strcasestr(add_columns, "flt"))   { ob_rfield(ob, "-", 8); ob_rfield(ob, "-", 8); }
+    if (strcasestr(add_columns, "rss"))     ob_rfield(ob, "-", 10);
+    if (strcasestr(add_columns, "prio"))    ob_rfield(ob, "-", 5);
+    if (strcasestr(add_columns, "cpuid"))   ob_rfield(ob, "-", 5);
+    if (strcasestr(add_columns, "schedstat")) { ob_rfield(ob, "-", 6); ob_rfield(ob, "-", 6); }
+    if (strcasestr(add_columns, "kstack"))  ob_field(ob, "-", 0);
+    if (delta_keepalive)                    ob_num(ob, 1, 7); // partial rows self-report one sample
+    ob->len--;
+    ob_putc(ob, '\n');
+}
+
+// --metrics aggregation: per-sample task counts by state, by syscall name and by
+// wchan, published for the HTTP exposition endpoint (metrics_main below). the emit
+// paths bump the current-sample tables as they format each row and the capture loop
+// swaps them with the published set at the end of every sample, so a scrape always
+// sees one complete sample and never blocks on one in progress. dashboards get the
+// "tasks in D state" / "threads blocked in fsync" style numbers straight from the
+// sampler instead of round-tripping raw CSVs through a log pipeline
+int metrics_port = 0;       // --metrics: TCP port of the exposition endpoint, 0 = mode off
+
+enum { MET_STATE, MET_SYSCALL, MET_WCHAN, MET_NDIMS };
+const char *met_dimnames[MET_NDIMS] = { "state", "syscall", "wchan" };
+
+struct metent {
+    char key[33];           // empty = free slot, sized like the aggent strings
+    long count;
+};
+struct metdim {
+    struct metent *tab;     // open addressing, like the summary table
+    unsigned int cap;       // always a power of two
+    unsigned int n;
+};
+unsigned int met_hash(const char *k) { // FNV-1a, same as the other tables here
+    unsigned int h = 2166136261u;
+    while (*k) {
+        h ^= (unsigned char) *k++;
+        h *= 16777619;
+    }
+    return h;
+}
+
+struct metdim met_cur[MET_NDIMS];  // the sample being captured right now
+struct metdim met_pub[MET_NDIMS];  // the last completed sample, what a scrape reads
+long long met_ts = 0;              // timestamp of the published sample
+long long met_samples = 0;         // cumulative counters for the endpoint, never reset
+long long met_scanned = 0;         // (unlike the windowed --stats equivalents)
+long long met_emitted = 0;
+pthread_mutex_t met_lock = PTHREAD_MUTEX_INITIALIZER; // -j workers bump concurrently,
+                                                      // the endpoint reads concurrently
+void met_bump(int dim, const char *key, int klen) {
+    struct metdim *d = &met_cur[dim];
+    struct metent *m, *newtab;
+    unsigned int h, i, newcap;
+    char k[33];
+
+    if (klen > (int) sizeof(k) - 1) klen = sizeof(k) - 1;
+    memcpy(k, key, klen);
+    k[klen] = 0;
+
+    pthread_mutex_lock(&met_lock);
+    if (!d->tab) {
+        d->cap = 256;
+        d->tab = calloc(d->cap, sizeof(struct metent));
+        if (!d->tab) { fprintf(stderr, "out of memory allocating metrics table\n"); exit(1); }
+    }
+    if (d->n + 1 > d->cap - d->cap / 4) { // stay under 75% full for short probe chains
+        newcap = d->cap * 2;
+        newtab = calloc(newcap, sizeof(struct metent));
+        if (!newtab) { fprintf(stderr, "out of memory growing metrics table\n"); exit(1); }
+        for (i = 0; i < d->cap; i++) {
+            if (!d->tab[i].key[0]) continue;
+            for (h = met_hash(d->tab[i].key) & (newcap - 1);
+                 newtab[h].key[0]; h = (h + 1) & (newcap - 1))
+                ;
+            newtab[h] = d->tab[i];
+        }
+        free(d->tab);
+        d->tab = newtab;
+        d->cap = newcap;
+    }
+    for (h = met_hash(k) & (d->cap - 1); ; h = (h + 1) & (d->cap - 1)) {
+        m = &d->tab[h];
+        if (!m->key[0]) {
+            strcpy(m->key, k);
+            d->n++;
+            break;
+        }
+        if (!strcmp(m->key, k)) break;
+    }
+    m->count++;
+    pthread_mutex_unlock(&met_lock);
+}
+
+// pull a just-appended field back out of the arena for counting: its text runs to
+// the first space or separator (syscall and wchan names contain neither)
+void met_bump_field(int dim, struct obuf *ob, size_t start) {
+    size_t i = start;
+    while (i < ob->len && ob->buf[i] != ' ' && ob->buf[i] != outsep && ob->buf[i] != '\n')
+        i++;
+    met_bump(dim, ob->buf + start, (int) (i - start));
+}
+
+// end of sample: swap the current tables into the published slot and clear the
+// (previously published) tables for the next sample. called from the capture loop,
+// but it only moves pointers and zeroes a few small tables
+void met_publish(long scanned, long emitted) {
+    struct metdim tmp;
+    unsigned int i;
+    int dim;
+
+    pthread_mutex_lock(&met_lock);
+    for (dim = 0; dim < MET_NDIMS; dim++) {
+        tmp = met_pub[dim];
+        met_pub[dim] = met_cur[dim];
+        met_cur[dim] = tmp;
+        for (i = 0; i < met_cur[dim].cap; i++) {
+            met_cur[dim].tab[i].key[0] = 0;
+            met_cur[dim].tab[i].count = 0;
+        }
+        met_cur[dim].n = 0;
+    }
+    met_ts = sample_ts_ms;
+    met_samples++;
+    met_scanned += scanned;
+    met_emitted += emitted;
+    pthread_mutex_unlock(&met_lock);
+}
+
+// --summary aggregation engine: instead of emitting every raw sample line, tasks are
+// counted into an open addressing hash table keyed by (state, comm, syscall, wchan and,
+// with -c kstack, the kernel stack) and a psn-style summary table is printed every N
+// sampling intervals. this is the same rollup bin/psn reconstructs offline by re-parsing
+// raw CSVs, done incrementally in the capture loop for ~free
+int summary_every = 0;      // --summary: emit after this many samples, 0 = mode off
+int agg_intervals = 0;      // samples accumulated into the current window
+
+struct aggent {
+    char state;             // 0 = empty slot
+    char comm[40];          // "(comm)" like the raw rows, parentheses included
+    char syscall[33];
+    char wchan[33];
+    char *kstack;           // only keyed/allocated with -c kstack
+    long count;
+};
+struct aggent *aggtab = NULL;
+unsigned int agg_cap = 0;   // always a power of two
+unsigned int agg_n = 0;
+pthread_mutex_t agg_lock = PTHREAD_MUTEX_INITIALIZER; // -j workers aggregate concurrently
+
+unsigned int agg_hashstr(unsigned int h, const char *str) { // FNV-1a continuation
+    while (*str) {
+        h ^= (unsigned char) *str++;
+        h *= 16777619;
+    }
+    return h;
+}
+
+// find or create the slot for this key with linear probing, the caller holds agg_lock
+struct aggent *agg_slot(struct aggent *tab, unsigned int cap, char state,
+                        const char *comm, const char *syscall, const char *wchan,
+                        const char *kstack) {
+    unsigned int h = 2166136261u;
+    struct aggent *a;
+
+    h ^= (unsigned char) state;
+    h *= 16777619;
+    h = agg_hashstr(h, comm);
+    h = agg_hashstr(h, syscall);
+    h = agg_hashstr(h, wchan);
+    if (kstack) h = agg_hashstr(h, kstack);
+
+    for (h &= cap - 1; ; h = (h + 1) & (cap - 1)) {
+        a = &tab[h];
+        if (!a->state) return a;
+        if (a->state == state && !strcmp(a->comm, comm) && !strcmp(a->syscall, syscall) &&
+            !strcmp(a->wchan, wchan) && (!kstack || !strcmp(a->kstack, kstack)))
+            return a;
+    }
+}
+
+void agg_add(char state, const char *comm, const char *syscall, const char *wchan,
+             const char *kstack) {
+    struct aggent *a, *newtab;
+    unsigned int newcap, i;
+
+    pthread_mutex_lock(&agg_lock);
+    if (!aggtab) {
+        agg_cap = 4096;
+        aggtab = calloc(agg_cap, sizeof(struct aggent));
+        if (!aggtab) { fprintf(stderr, "out of memory allocating summary table\n"); exit(1); }
+    }
+    if (agg_n + 1 > agg_cap - agg_cap / 4) { // stay under 75% full for short probe chains
+        newcap = agg_cap * 2;
+        newtab = calloc(newcap, sizeof(struct aggent));
+        if (!newtab) { fprintf(stderr, "out of memory growing summary table\n"); exit(1); }
+        for (i = 0; i < agg_cap; i++) {
+            if (!aggtab[i].state) continue;
+            *agg_slot(newtab, newcap, aggtab[i].state, aggtab[i].comm, aggtab[i].syscall,
+                      aggtab[i].wchan, aggtab[i].kstack) = aggtab[i]; // kstack ptr moves along
+        }
+        free(aggtab);
+        aggtab = newtab;
+        agg_cap = newcap;
+    }
+    a = agg_slot(aggtab, agg_cap, state, comm, syscall, wchan, kstack);
+    if (!a->state) {
+        a->state = state;
+        strncpy(a->comm, comm, sizeof(a->comm) - 1);
+        strncpy(a->syscall, syscall, sizeof(a->syscall) - 1);
+        strncpy(a->wchan, wchan, sizeof(a->wchan) - 1);
+        if (kstack) a->kstack = strdup(kstack);
+        agg_n++;
+    }
+    a->count++;
+    pthread_mutex_unlock(&agg_lock);
+}
+
+// the per-task half of the summary path: pull out the same key strings bin_emitrow
+// interns, then bump the rollup counter instead of formatting a raw row
+void agg_record(struct capture_ctx *ctx, int pid, int tid, struct statidx *ix,
+                char *add_columns) {
+
+    char *filebuf = ctx->filebuf;
+    char *p, *field;
+    const char *scname;
+    char scbuf[16];  // raw syscall numbers and the wchan are copied out of filebuf -
+    char wchan[33];  // the reads that follow each of them reuse that buffer
+    int b;
+
+    p = ctx->pre_syscall;
+    b = p ? ctx->pre_syscalln : readfile(pid, tid, "syscall", filebuf);
+    if (!p) p = filebuf;
+    scname = "-";
+    if (b > 0 && (field = strsep(&p, WSP))) {
+        scname = field[0]=='r' ? "[running]" : field[0]=='-' ? "[no_syscall]" : syscall_name(atoi(field));
+        if (!scname) { // raw number for anything the arch table can't name
+            strncpy(scbuf, field, sizeof(scbuf) - 1);
+            scbuf[sizeof(scbuf) - 1] = 0;
+            scname = scbuf;
+        }
+    }
+
+    p = ctx->pre_wchan;
+    b = p ? ctx->pre_wchann : readfile(pid, tid, "wchan", filebuf);
+    if (!p) p = filebuf;
+    field = b > 0 ? strsep(&p, ". \n") : NULL;
+    strncpy(wchan, field && field[0] ? field : "-", sizeof(wchan) - 1);
+    wchan[sizeof(wchan) - 1] = 0;
+
+    if (metrics_port) {
+        met_bump(MET_STATE, &ix->state, 1);
+        met_bump(MET_SYSCALL, scname, strlen(scname));
+        met_bump(MET_WCHAN, wchan, strlen(wchan));
+    }
+
+    if (strcasestr(add_columns, "kstack")) {
+        b = readfile(pid, tid, "stack", filebuf);
+        ctx->kscratch.len = 0;
+        if (b > 0) outputstack_interned(&ctx->kscratch, filebuf, b);
+        if (!ctx->kscratch.len) ob_str(&ctx->kscratch, "-");
+        ob_putc(&ctx->kscratch, 0);
+        agg_add(ix->state, ix->f[2], scname, wchan, ctx->kscratch.buf);
+    }
+    else
+        agg_add(ix->state, ix->f[2], scname, wchan, NULL);
+}
+
+int agg_cmp(const void *a, const void *b) { // busiest groups first
+    long d = (*(struct aggent **) b)->count - (*(struct aggent **) a)->count;
+    return d > 0 ? 1 : d < 0 ? -1 : 0;
+}
+
+// print the window rollup into the serial arena (the writer flushes it like any other
+// sample) and reset the table for the next window
+void agg_emit(struct obuf *ob, int nsamples, char *add_columns) {
+
+    struct aggent **sorted;
+    unsigned int i, ns = 0;
+    long avg100;
+    char tmp[32];
+    int kstack = strcasestr(add_columns, "kstack") != NULL;
+
+    sorted = malloc((agg_n ? agg_n : 1) * sizeof(struct aggent *));
+    if (!sorted) return;
+    for (i = 0; i < agg_cap && aggtab; i++)
+        if (aggtab[i].state) sorted[ns++] = &aggtab[i];
+    qsort(sorted, ns, sizeof(struct aggent *), agg_cmp);
+
+    ob_putc(ob, '\n');
+    ob_rfield(ob, "SAMPLES", 8);
+    ob_rfield(ob, "AVG_THR", 8);
+    ob_field(ob, "ST", 3);
+    ob_field(ob, "COMMAND", 25);
+    ob_field(ob, "SYSCALL", 25);
+    ob_field(ob, "WCHAN", 25);
+    if (kstack) ob_field(ob, "KSTACK", 0);
+    ob->len--; // the header line carries no trailing separator, like the raw output
+    ob_putc(ob, '\n');
+
+    for (i = 0; i < ns; i++) {
+        char statebuf[2] = { sorted[i]->state, 0 };
+        ob_num(ob, sorted[i]->count, 8);
+        avg100 = sorted[i]->count * 100 / nsamples; // avg concurrently active threads
+        snprintf(tmp, sizeof(tmp), "%ld.%02ld", avg100 / 100, avg100 % 100);
+        ob_rfield(ob, tmp, 8);
+        ob_field(ob, statebuf, 3);
+        ob_field(ob, sorted[i]->comm, 25);
+        ob_field(ob, sorted[i]->syscall, 25);
+        ob_field(ob, sorted[i]->wchan, 25);
+        if (kstack) ob_str(ob, sorted[i]->kstack);
+        else ob->len--;
+        ob_putc(ob, '\n');
+    }
+    free(sorted);
+
+    for (i = 0; i < agg_cap; i++) { // reset the window, the table allocation is kept
+        free(aggtab[i].kstack);
+        aggtab[i].kstack = NULL;
+        aggtab[i].state = 0;
+        aggtab[i].count = 0;
+    }
+    agg_n = 0;
+}
+
+// -F binary row: same per-task reads as the text path below, but all strings are
+// interned up front (a dictionary record must never split the row framing) and the
+// row is emitted as one fixed-layout record
+void bin_emitrow(struct capture_ctx *ctx, int pid, int tid, uid_t proc_uid,
+                 struct statidx *ix, struct fdc_entry *e, char *add_columns) {
+
+    struct obuf *ob = &ctx->ob;
+    char *filebuf = ctx->filebuf;
+    unsigned int uid_id, comm_id, sys_id, wchan_id, exe_id = 0, cmd_id = 0, kstack_id = 0;
+    unsigned short colflags = bin_colflags(add_columns);
+    long long cputicks_d = XCAP_BIN_NOVAL, minflt_d = XCAP_BIN_NOVAL, majflt_d = XCAP_BIN_NOVAL;
+    long long cpu10 = XCAP_BIN_NOVAL, lat10 = XCAP_BIN_NOVAL;
+    unsigned long long cputicks, minflt, majflt;
+    int b;
+    char *p, *field, *pos;
+    const char *scname;
+    char sympath[64];
+
+    uid_id  = dict_intern(ob, getusername(proc_uid));
+    comm_id = dict_intern(ob, ix->f[2]);
+
+    p = ctx->pre_syscall;
+    b = p ? ctx->pre_syscalln : readfile(pid, tid, "syscall", filebuf);
+    if (!p) p = filebuf;
+    scname = "-";
+    if (b > 0 && (field = strsep(&p, WSP))) {
+        scname = field[0]=='r' ? "[running]" : field[0]=='-' ? "[no_syscall]" : syscall_name(atoi(field));
+        if (!scname) scname = field; // raw number for anything the arch table can't name
+    }
+    sys_id = dict_intern(ob, scname);
+    if (metrics_port) // count now, the wchan read below reuses the buffer scname may point into
+        met_bump(MET_SYSCALL, scname, strlen(scname));
+
+    p = ctx->pre_wchan;
+    b = p ? ctx->pre_wchann : readfile(pid, tid, "wchan", filebuf);
+    if (!p) p = filebuf;
+    field = b > 0 ? strsep(&p, ". \n") : NULL;
+    wchan_id = dict_intern(ob, field && field[0] ? field : "-");
+
+    if (metrics_port) {
+        const char *wcname = field && field[0] ? field : "-";
+        met_bump(MET_STATE, &ix->state, 1);
+        met_bump(MET_WCHAN, wcname, strlen(wcname));
+    }
+
+    if (colflags & XCAP_COL_EXE) {
+        if (e && !e->exe) {
+            tid ? sprintf(sympath, "%s/%d/task/%d/exe", procfs_root, pid, tid) : sprintf(sympath, "%s/%d/exe", procfs_root, pid);
+            b = readlink(sympath, filebuf, PATH_MAX);
+            if (b > 0) {
+                filebuf[b] = 0;
+                pos = strrchr(filebuf, '/');
+                e->exe = strdup(pos ? pos + 1 : filebuf);
+            }
+        }
+        exe_id = dict_intern(ob, e && e->exe ? e->exe : "-");
+    }
+    if (colflags & XCAP_COL_CMDLINE) {
+        if (e && !e->cmdline) {
+            b = readfile(pid, tid, "cmdline", filebuf);
+            if (b > 0) e->cmdline = strdup(filebuf);
+        }
+        cmd_id = dict_intern(ob, e && e->cmdline ? e->cmdline : "-");
+    }
+    if (colflags & XCAP_COL_CPUTIME) {
+        cputicks = (ix->f[14] ? strtoull(ix->f[14], NULL, 10) : 0) +
+                   (ix->f[15] ? strtoull(ix->f[15], NULL, 10) : 0);
+        if (e && e->prev_counters_valid) cputicks_d = cputicks - e->prev_cputicks;
+        if (e) e->prev_cputicks = cputicks;
+    }
+    if (colflags & XCAP_COL_FLT) {
+        minflt = ix->f[10] ? strtoull(ix->f[10], NULL, 10) : 0;
+        majflt = ix->f[12] ? strtoull(ix->f[12], NULL, 10) : 0;
+        if (e && e->prev_counters_valid) {
+            minflt_d = minflt - e->prev_minflt;
+            majflt_d = majflt - e->prev_majflt;
+        }
+        if (e) { e->prev_minflt = minflt; e->prev_majflt = majflt; }
+    }
+    if (e && (colflags & (XCAP_COL_CPUTIME | XCAP_COL_FLT)))
+        e->prev_counters_valid = 1;
+    if (colflags & XCAP_COL_SCHED) {
+        b = readfile(pid, tid, "schedstat", filebuf);
+        if (e && b > 0) schedstat_pct10(e, filebuf, &cpu10, &lat10);
+    }
+    if (colflags & XCAP_COL_KSTACK) {
+        b = readfile(pid, tid, "stack", filebuf);
+        ctx->kscratch.len = 0;
+        if (b > 0) outputstack_interned(&ctx->kscratch, filebuf, b);
+        if (!ctx->kscratch.len) ob_str(&ctx->kscratch, "-");
+        ob_putc(&ctx->kscratch, 0);
+        kstack_id = dict_intern(ob, ctx->kscratch.buf);
+    }
+
+    ob_putc(ob, XCAP_TAG_ROW);
+    ob_bin64(ob, (unsigned long long) sample_ts_ms);
+    ob_bin32(ob, pid);
+    ob_bin32(ob, tid);
+    ob_bin32(ob, uid_id);
+    ob_putc(ob, ix->state);
+    ob_bin32(ob, comm_id);
+    ob_bin32(ob, sys_id);
+    ob_bin32(ob, wchan_id);
+    if (colflags & XCAP_COL_EXE)     ob_bin32(ob, exe_id);
+    if (colflags & XCAP_COL_CMDLINE) ob_bin32(ob, cmd_id);
+    if (colflags & XCAP_COL_CPUTIME) ob_bin64(ob, cputicks_d);
+    if (colflags & XCAP_COL_FLT)   { ob_bin64(ob, minflt_d); ob_bin64(ob, majflt_d); }
+    if (colflags & XCAP_COL_RSS)     ob_bin64(ob, ix->f[24] ? strtoll(ix->f[24], NULL, 10) : XCAP_BIN_NOVAL);
+    if (colflags & XCAP_COL_PRIO)    ob_bin64(ob, ix->f[18] ? strtoll(ix->f[18], NULL, 10) : XCAP_BIN_NOVAL);
+    if (colflags & XCAP_COL_CPUID)   ob_bin64(ob, ix->f[39] ? strtoll(ix->f[39], NULL, 10) : XCAP_BIN_NOVAL);
+    if (colflags & XCAP_COL_SCHED) { ob_bin64(ob, cpu10); ob_bin64(ob, lat10); }
+    if (colflags & XCAP_COL_KSTACK)  ob_bin32(ob, kstack_id);
+}
+
+int outputprocentry(struct capture_ctx *ctx, int pid, int tid, char *sampletime, uid_t proc_uid, char *add_columns) {
+
+    int b;
+    int presys_handover = 0;  // --syscall filter read the syscall file for the row path
+    char task_status;         // used for early bailout, filtering by task status
+    char sympath[64];
+    char commnow[20];         // comm without the parens, for exec detection
+    char statusbuf[2] = { 0, 0 };
+    char *pos;
+    struct fdc_entry *e;
+    size_t n;
+    size_t row_start = 0, body_start = 0, tuple_end = 0, kst_start = 0; // --delta row regions
+    size_t sys_start = 0, wch_start = 0; // --metrics counts these fields off the arena
+    size_t hdr_mark = 0;
+    int hdr_was = 0;
+    unsigned int sig, oldcnt;
+    char *oldrow;
+    int oldlen;
+    struct statidx ixbuf, *ix = NULL;
+    struct obuf *ob = &ctx->ob;
+    char *statbuf = ctx->statbuf;
+    char *filebuf = ctx->filebuf;
+
+    // sampleprocess() hands over the already-read-and-indexed pid level stat line via
+    // ctx->statidx for single threaded processes, and the io_uring engine hands over
+    // everything it already read in its batch via the ctx->pre_* buffers. only a
+    // thread level read indexes here - each stat line is parsed exactly once
+    if (ctx->statidx_valid) {
+        ctx->statidx_valid = 0;
+        ix = &ctx->statidx;
+        b = 2;
+    }
+    else {
+        if (ctx->pre_stat) {
+            statbuf = ctx->pre_stat;
+            b = ctx->pre_statn;
+        }
+        else {
+            b = readfile(pid, tid, "stat", statbuf);
+        }
+        // the statindex() failure check below also covers /proc not having read consistency
+        // (rarely in-flux values are shown as \0\0\0\0\0\0\0...)
+        if (b > 0 && !statindex(statbuf, &ixbuf))
+            ix = &ixbuf;
+    }
+
+    if (b > 0 && ix) {
+
+        task_status = ix->state;
+
+        if (!strchr(exclude_states, task_status)) {  // task status is not in X,Z,I (S)
+
+            // comm snapshot for exec detection: a changed comm invalidates cached exe/cmdline
+            n = strlen(ix->f[2]);
+            if (n >= 2) {
+                if (n - 2 > sizeof(commnow) - 1) n = sizeof(commnow) + 1;
+                memcpy(commnow, ix->f[2] + 1, n - 2);
+                commnow[n - 2] = 0;
+            }
+            else commnow[0] = 0;
+
+            // exe and cmdline essentially never change within a pid lifetime, so they are
+            // served from the fd cache entry and only re-read when the comm changed (exec).
+            // an exec to a binary with the same comm slips through this check, accepted
+            e = (delta_keepalive ||
+                 strcasestr(add_columns, "exe") || strcasestr(add_columns, "cmdline") ||
+                 strcasestr(add_columns, "cputime") || strcasestr(add_columns, "flt") ||
+                 strcasestr(add_columns, "schedstat")) ? fdc_lookup(pid, tid) : NULL;
+            if (e && strcmp(e->comm, commnow)) { // first sighting or exec, drop cached values
+                free(e->exe);
+                free(e->cmdline);
+                e->exe = e->cmdline = NULL;
+                strncpy(e->comm, commnow, sizeof(e->comm) - 1);
+                e->comm[sizeof(e->comm) - 1] = 0;
+            }
+
+            if (filter_sys_on) { // --syscall, right after the cheapest read that can tell
+                if (ctx->pre_syscall) {
+                    if (!filter_sys_pass(syscall_nr_peek(ctx->pre_syscall, ctx->pre_syscalln)))
+                        return 0;
+                }
+                else {
+                    b = readfile(pid, tid, "syscall", filebuf);
+                    if (!filter_sys_pass(syscall_nr_peek(filebuf, b))) return 0;
+                    if (b > 0) { // hand the buffer over so the row path won't read it again
+                        ctx->pre_syscall = filebuf;
+                        ctx->pre_syscalln = b;
+                        presys_handover = 1;
+                    }
+                }
+            }
+
+            ctx->emitted++;
+            if (task_status == 'D') ctx->dstate++;
+            if (tiered_k) tier_mark_active(pid);
+
+            if (summary_every) { // rollup only, no raw row to format
+                agg_record(ctx, pid, tid, ix, add_columns);
+                if (presys_handover) ctx->pre_syscall = NULL;
+                return 0;
+            }
+
+            if (output_format == 'B') {
+                bin_emitrow(ctx, pid, tid, proc_uid, ix, e, add_columns);
+                if (presys_handover) ctx->pre_syscall = NULL;
+                return 0;
+            }
+
+            // only print header (in stdout mode) when there are any samples to report
+            hdr_mark = ob->len;
+            hdr_was = header_printed;
+            if (ctx->print_header)
+                header_printed = header_printed ? 1 : outputheader(ob, add_columns);
+
+            statusbuf[0] = task_status;
+            row_start = ob->len;  // --delta may roll the whole row back out of the arena
+            ob_field(ob, sampletime, 23);
+            body_start = ob->len; // the row body behind the timestamp is what gets remembered
+            ob_num(ob, pid, 7);
+            ob_num(ob, tid, 7);
+            ob_field(ob, getusername(proc_uid), 15);
+            ob_field(ob, statusbuf, 2);
+            ob_field(ob, ix->f[2], 25); // "(comm)", spaces preserved
+
+            sys_start = ob->len;
+            b = ctx->pre_syscall ? ctx->pre_syscalln : readfile(pid, tid, "syscall", filebuf);
+            if (b > 0) { outputfields(ob, ctx->pre_syscall ? ctx->pre_syscall : filebuf, "S", WSP); } else { ob_field(ob, "-", 25); }
+            if (presys_handover) ctx->pre_syscall = NULL; // consumed, filebuf gets reused below
+
+            wch_start = ob->len;
+            b = ctx->pre_wchan ? ctx->pre_wchann : readfile(pid, tid, "wchan", filebuf);
+            if (b > 0) { outputfields(ob, ctx->pre_wchan ? ctx->pre_wchan : filebuf, "O", ". \n"); } else { ob_field(ob, "-", 25); }
+            tuple_end = ob->len;  // columns beyond wchan (except kstack) are not tuple members
+
+            if (metrics_port) { // counted even when --delta suppresses the row below
+                met_bump(MET_STATE, statusbuf, 1);
+                met_bump_field(MET_SYSCALL, ob, sys_start);
+                met_bump_field(MET_WCHAN, ob, wch_start);
+            }
+
+            if (strcasestr(add_columns, "exe")) {
+                if (e && !e->exe) {
+                    tid ? sprintf(sympath, "%s/%d/task/%d/exe", procfs_root, pid, tid) : sprintf(sympath, "%s/%d/exe", procfs_root, pid);
+                    b = readlink(sympath, filebuf, PATH_MAX);
+                    if (b > 0) {
+                        filebuf[b] = 0;
+                        pos = strrchr(filebuf, '/');
+                        e->exe = strdup(pos ? pos + 1 : filebuf);
+                    }
+                }
+                ob_field(ob, e && e->exe ? e->exe : "-", 20);
+            }
+
+            if (strcasestr(add_columns, "cmdline")) {
+                if (e && !e->cmdline) {
+                    b = readfile(pid, tid, "cmdline", filebuf); // contains spaces and \0s within data TODO escape (or just print argv[0])
+                    if (b > 0) e->cmdline = strdup(filebuf);
+                }
+                ob_field(ob, e && e->cmdline ? e->cmdline : "-", 30);
+            }
+
+            // cheap numeric columns straight off the stat field index. the delta columns
+            // print "-" on a task's first sample (no previous counters yet)
+            if (strcasestr(add_columns, "cputime")) {
+                unsigned long long cputicks = (ix->f[14] ? strtoull(ix->f[14], NULL, 10) : 0) +
+                                              (ix->f[15] ? strtoull(ix->f[15], NULL, 10) : 0);
+                if (e && e->prev_counters_valid)
+                    ob_num(ob, cputicks - e->prev_cputicks, 8);
+                else
+                    ob_rfield(ob, "-", 8);
+                if (e) e->prev_cputicks = cputicks;
+            }
+            if (strcasestr(add_columns, "flt")) {
+                unsigned long long minflt = ix->f[10] ? strtoull(ix->f[10], NULL, 10) : 0;
+                unsigned long long majflt = ix->f[12] ? strtoull(ix->f[12], NULL, 10) : 0;
+                if (e && e->prev_counters_valid) {
+                    ob_num(ob, minflt - e->prev_minflt, 8);
+                    ob_num(ob, majflt - e->prev_majflt, 8);
+                }
+                else {
+                    ob_rfield(ob, "-", 8);
+                    ob_rfield(ob, "-", 8);
+                }
+                if (e) { e->prev_minflt = minflt; e->prev_majflt = majflt; }
+            }
+            if (e && (strcasestr(add_columns, "cputime") || strcasestr(add_columns, "flt")))
+                e->prev_counters_valid = 1;
+            if (strcasestr(add_columns, "rss"))
+                ob_rfield(ob, ix->f[24] ? ix->f[24] : "-", 10);
+            if (strcasestr(add_columns, "prio"))
+                ob_rfield(ob, ix->f[18] ? ix->f[18] : "-", 5);
+            if (strcasestr(add_columns, "cpuid"))
+                ob_rfield(ob, ix->f[39] ? ix->f[39] : "-", 5);
+
+            // run-queue latency view: on-cpu and waiting-to-run share of the wall time
+            // since this task's previous sample, "-" until there is a sample to diff with
+            if (strcasestr(add_columns, "schedstat")) {
+                long long cpu10, lat10;
+                char pctbuf[24];
+                b = readfile(pid, tid, "schedstat", filebuf);
+                if (e && b > 0 && schedstat_pct10(e, filebuf, &cpu10, &lat10)) {
+                    sprintf(pctbuf, "%lld.%lld", cpu10 / 10, cpu10 % 10);
+                    ob_rfield(ob, pctbuf, 6);
+                    sprintf(pctbuf, "%lld.%lld", lat10 / 10, lat10 % 10);
+                    ob_rfield(ob, pctbuf, 6);
+                }
+                else {
+                    ob_rfield(ob, "-", 6);
+                    ob_rfield(ob, "-", 6);
+                }
+            }
+
+            kst_start = ob->len;
+            if (strcasestr(add_columns, "kstack")) {
+                b = readfile(pid, tid, "stack", filebuf);
+                if (b > 0) { outputstack_interned(ob, filebuf, b); } else { ob_putc(ob, '-'); }
+                if (delta_keepalive) ob_putc(ob, outsep); // kstack is no longer the last column
+            }
+
+            // --delta: the row is fully formatted by now, but only leaves the arena when
+            // the tuple changed since this task's last written row or a keepalive is due.
+            // varying per-sample numbers (cputime, flt, rss...) sit outside the hashed
+            // regions so they don't defeat the suppression
+            if (delta_keepalive && e) {
+                sig = delta_hash(ob->buf + body_start, tuple_end - body_start, 2166136261u);
+                sig = delta_hash(ob->buf + kst_start, ob->len - kst_start, sig);
+
+                if (e->delta_row && sig == e->delta_sig) {
+                    if (++e->delta_cnt < (unsigned int) delta_keepalive) {
+                        ob->len = row_start; // same tuple, keepalive not due: drop the row
+                        if (ctx->print_header && !hdr_was) { // take a just-printed header
+                            ob->len = hdr_mark;              // back out with it too
+                            header_printed = 0;
+                        }
+                        return 0;
+                    }
+                    ob_num(ob, e->delta_cnt, 7); // keepalive: flush the suppressed sample count
+                    e->delta_cnt = 0;
+                    ob_putc(ob, '\n');
+                    return 0;
+                }
+
+                // tuple changed (or first sample): this row stands for one sample, and any
+                // count the previous tuple accumulated since its last report is flushed as
+                // one extra row so the per-tuple SAMPLES sums stay exact
+                oldrow = e->delta_row;
+                oldlen = e->delta_rowlen;
+                oldcnt = e->delta_cnt;
+                e->delta_rowlen = (e->delta_row = malloc(ob->len - body_start)) ? (int) (ob->len - body_start) : 0;
+                if (e->delta_row) memcpy(e->delta_row, ob->buf + body_start, e->delta_rowlen);
+                e->delta_sig = sig;
+                e->delta_cnt = 0;
+                ob_num(ob, 1, 7);
+                ob_putc(ob, '\n');
+                if (oldrow && oldcnt) {
+                    ob_field(ob, sampletime, 23);
+                    ob_mem(ob, oldrow, oldlen);
+                    ob_num(ob, oldcnt, 7);
+                    ob_putc(ob, '\n');
+                }
+                free(oldrow);
+                return 0;
+            }
+
+            if (delta_keepalive) ob_num(ob, 1, 7); // no cache entry (task vanishing), still one sample
+            ob_putc(ob, '\n');
+        }
+    }
+    else {
+        outputprocpartial(ctx, pid, tid, sampletime, proc_uid, add_columns, "[task_entry_lost(read)]");
+        return 1;
+    }
+
+    return 0;
+}
+
+// /proc/kallsyms symbol table, used by the BPF engine to turn raw kernel stack
+// addresses into the same function names the procfs wchan/stack files would show
+struct ksym {
+    unsigned long long addr;
+    char *name;
+};
+
+struct ksym *ksyms = NULL;
+int nksyms = 0, ksyms_cap = 0;
+
+int ksym_cmp(const void *a, const void *b) {
+    unsigned long long aa = ((const struct ksym *) a)->addr;
+    unsigned long long ba = ((const struct ksym *) b)->addr;
+    return aa < ba ? -1 : aa > ba ? 1 : 0;
+}
+
+int kallsyms_load(void) {
+    FILE *f = fopen("/proc/kallsyms", "r");
+    unsigned long long addr;
+    char type;
+    char name[256];
+
+    if (!f) return -1;
+    while (fscanf(f, "%llx %c %255s%*[^\n]", &addr, &type, name) == 3) {
+        if (type != 't' && type != 'T' && type != 'w' && type != 'W') continue;
+        if (!addr) continue; // kptr_restrict hides addresses, table would be useless
+        if (nksyms == ksyms_cap) {
+            ksyms_cap = ksyms_cap ? ksyms_cap * 2 : 65536;
+            ksyms = realloc(ksyms, ksyms_cap * sizeof(struct ksym));
+            if (!ksyms) { fprintf(stderr, "out of memory allocating kallsyms table\n"); exit(1); }
+        }
+        ksyms[nksyms].addr = addr;
+        ksyms[nksyms].name = strdup(name);
+        nksyms++;
+    }
+    fclose(f);
+    if (!nksyms) return -1;
+    qsort(ksyms, nksyms, sizeof(struct ksym), ksym_cmp);
+    return 0;
+}
+
+// greatest symbol at or below addr, NULL when the table has no covering symbol
+const char *kallsyms_lookup(unsigned long long addr) {
+    int lo = 0, hi = nksyms - 1, mid;
+
+    if (!nksyms || addr < ksyms[0].addr) return NULL;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (ksyms[mid].addr <= addr)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return ksyms[lo].name;
+}
+
+#ifdef HAVE_LIBBPF
+
+// --engine=bpf: attach the task iterator program from xcapture_task_iter.bpf.o and, each
+// sample, read one coherent kernel-pass snapshot of all tasks from a fresh iterator fd
+struct bpf_object *bpf_obj = NULL;
+struct bpf_link *bpf_task_iter_link = NULL;
+
+int bpf_engine_init(void) {
+    struct bpf_program *prog;
+    const char *paths[] = { "bin/xcapture_task_iter.bpf.o", "/usr/lib/0xtools/xcapture_task_iter.bpf.o", NULL };
+    int i;
+
+    for (i = 0; paths[i]; i++) {
+        bpf_obj = bpf_object__open_file(paths[i], NULL);
+        if (bpf_obj) break;
+    }
+    if (!bpf_obj) {
+        fprintf(stderr, "cannot open xcapture_task_iter.bpf.o (run make ebpf)\n");
+        return -1;
+    }
+    if (bpf_object__load(bpf_obj)) {
+        fprintf(stderr, "cannot load BPF task iterator (kernel >= 5.8 with BTF needed)\n");
+        return -1;
+    }
+    prog = bpf_object__find_program_by_name(bpf_obj, "xcap_task_iter");
+    if (!prog) {
+        fprintf(stderr, "xcap_task_iter program not found in BPF object\n");
+        return -1;
+    }
+    bpf_task_iter_link = bpf_program__attach_iter(prog, NULL);
+    if (!bpf_task_iter_link) {
+        fprintf(stderr, "cannot attach BPF task iterator\n");
+        return -1;
+    }
+    if (kallsyms_load())
+        fprintf(stderr, "warning: /proc/kallsyms unavailable, BPF engine prints raw addresses\n");
+    return 0;
+}
+
+// map raw task state bits to the single letter procfs uses
+char bpf_state_letter(unsigned int state, unsigned int exit_state) {
+    if (exit_state & 0x0020) return 'Z'; // EXIT_ZOMBIE
+    if (exit_state & 0x0010) return 'X'; // EXIT_DEAD
+    if (state & 0x0400) return 'I';      // TASK_NOLOAD -> idle kernel thread
+    if (state & 0x0002) return 'D';      // TASK_UNINTERRUPTIBLE
+    if (state & 0x0001) return 'S';      // TASK_INTERRUPTIBLE
+    if (state & 0x000c) return 'T';      // __TASK_STOPPED | __TASK_TRACED
+    return 'R';
+}
+
+// scheduler entry frames carry no information, skip them like kernel get_wchan() does
+int bpf_sched_frame(const char *name) {
+    return !strcmp(name, "__schedule") || !strcmp(name, "schedule") ||
+           !strcmp(name, "schedule_timeout") || !strcmp(name, "schedule_hrtimeout_range_clock") ||
+           !strcmp(name, "schedule_hrtimeout_range") || !strcmp(name, "do_nanosleep");
+}
+
+void bpf_emitrec(struct capture_ctx *ctx, struct xcap_bpf_rec *rec, char *sampletime, char *add_columns) {
+
+    struct obuf *ob = &ctx->ob;
+    char state = bpf_state_letter(rec->state, rec->exit_state);
+    char statebuf[2] = { 0, 0 };
+    int nframes = rec->kstack_bytes / sizeof(unsigned long long);
+    const char *sym;
+    const char *wchan = NULL;
+    const char *scname;
+    char commbuf[20];
+    char nrbuf[16];
+    int i, b;
+
+    if (strchr(exclude_states, state)) return;
+    if (!filter_pid_pass(rec->tgid)) return;
+    if (nfilter_uid && !filter_uid_pass(rec->uid)) return;
+    if (filter_comm && !filter_comm_pass(rec->comm)) return;
+    if (!filter_sys_pass(rec->syscall_nr >= 0 ? rec->syscall_nr : state == 'R' ? -2 : -1)) return;
+
+    if (ctx->print_header)
+        header_printed = header_printed ? 1 : outputheader(ob, add_columns);
+    ctx->emitted++;
+    if (state == 'D') ctx->dstate++;
+
+    // first non-scheduler stack frame doubles as the wchan, like kernel get_wchan()
+    for (i = 0; i < nframes && !wchan; i++) {
+        sym = kallsyms_lookup(rec->kstack[i]);
+        if (sym && !bpf_sched_frame(sym)) wchan = sym;
+    }
+
+    snprintf(commbuf, sizeof(commbuf), "(%s)", rec->comm);
+    statebuf[0] = state;
+    ob_field(ob, sampletime, 23);
+    ob_num(ob, rec->tgid, 7);
+    ob_num(ob, rec->pid, 7);
+    ob_field(ob, getusername(rec->uid), 15);
+    ob_field(ob, statebuf, 2);
+    ob_field(ob, commbuf, 25);
+    scname = state == 'R' ? "[running]" : rec->syscall_nr < 0 ? "[no_syscall]" : syscall_name(rec->syscall_nr);
+    if (!scname) { sprintf(nrbuf, "%d", rec->syscall_nr); scname = nrbuf; }
+    ob_field(ob, scname, 25);
+    ob_field(ob, wchan ? wchan : (state == 'R' ? "0" : "-"), 25);
+
+    // exe and cmdline are not part of the kernel snapshot, read them via the fd cache
+    if (strcasestr(add_columns, "exe")) {
+        char sympath[64];
+        sprintf(sympath, "/proc/%d/task/%d/exe", rec->tgid, rec->pid);
+        b = readlink(sympath, ctx->filebuf, PATH_MAX);
+        if (b > 0) { ctx->filebuf[b] = 0; outputfields(ob, ctx->filebuf, "E", WSP); }
+        else { ob_field(ob, "-", 20); }
+    }
+    if (strcasestr(add_columns, "cmdline")) {
+        b = readfile(rec->tgid, rec->pid, "cmdline", ctx->filebuf);
+        ob_field(ob, b > 0 ? ctx->filebuf : "-", 30);
+    }
+    if (strcasestr(add_columns, "kstack")) {
+        // innermost frame last, matching the /proc/PID/stack text parser's ordering
+        for (i = nframes - 1; i >= 0; i--) {
+            sym = kallsyms_lookup(rec->kstack[i]);
+            if (!sym) continue;
+            if (!strcmp(sym, "entry_SYSCALL_64_after_hwframe") || !strcmp(sym, "do_syscall_64")) continue;
+            ob_str(ob, "->");
+            ob_str(ob, sym);
+            ob_str(ob, "()");
+        }
+    }
+
+    ob_putc(ob, '\n');
+}
+
+// one sample pass over every task in the system through the BPF iterator
+void bpf_sample(struct capture_ctx *ctx, char *sampletime, char *add_columns) {
+
+    struct xcap_bpf_rec recs[64];
+    int ifd, nbytes, nrecs, i;
+    int mypid = getpid();
+
+    ifd = bpf_iter_create(bpf_link__fd(bpf_task_iter_link));
+    if (ifd < 0) {
+        fprintf(stderr, "bpf_iter_create error='%s'\n", strerror(errno));
+        return;
+    }
+    while ((nbytes = read(ifd, recs, sizeof(recs))) > 0) {
+        nrecs = nbytes / sizeof(struct xcap_bpf_rec);
+        for (i = 0; i < nrecs; i++) {
+            if (recs[i].tgid == mypid) continue;
+            bpf_emitrec(ctx, &recs[i], sampletime, add_columns);
+        }
+    }
+    close(ifd);
+}
+
+#endif // HAVE_LIBBPF
+
+// sample one /proc/PID entry: read its stat file and emit either the single task
+// or walk /proc/PID/task for multithreaded processes (moved out of main() for -j workers)
+void sampleprocess(struct capture_ctx *ctx, int pid, char *sampletime, char *add_columns) {
+
+    char dirpath[PATH_MAX]; // used for /proc stuff only, so no long paths
+    DIR *td;
+    struct dirent *tde;     // thread/task level directory entries in /proc/PID/task
+    uid_t proc_uid;
+    int nthreads = 0;
+
+    proc_uid = fdc_uid(pid);
+    if (nfilter_uid && !filter_uid_pass(proc_uid)) return; // -u, costs one dirfd stat only
+
+    // if not multithreaded, read current /proc/PID/x files for efficiency. "nthreads" is 20th field in proc/PID/stat
+    if (readfile(pid, 0, "stat", ctx->statbuf) > 0 && !statindex(ctx->statbuf, &ctx->statidx)) {
+        if (!filter_comm_pass(ctx->statidx.f[2])) return; // --comm, before any thread reads
+        nthreads = ctx->statidx.f[20] ? atoi(ctx->statidx.f[20]) : 0;
+
+        if (nthreads > 1) {
+            sprintf(dirpath, "%s/%d/task", procfs_root, pid);
+
+            td = opendir(dirpath);
+            if (td) {
+
+                while ((tde = readdir(td))) { // proc/PID/task/TID
+                    if (tde->d_name[0] >= '0' && tde->d_name[0] <= '9') {
+                        outputprocentry(ctx, pid, atoi(tde->d_name), sampletime, proc_uid, add_columns); 
+                    }
+                }
+                closedir(td);
+            }
+            else {
+                outputprocpartial(ctx, pid, -1, sampletime, proc_uid, add_columns, "[task_entry_lost(list)]");
+            }
+        } 
+        else { // nthreads <= 1, therefore pid == tid - reuse the index built above
+            ctx->statidx_valid = 1;
+            outputprocentry(ctx, pid, pid, sampletime, proc_uid, add_columns);
+            ctx->statidx_valid = 0;
+        }
+
+    } // readfile(statbuf)
+    else {
+        outputprocpartial(ctx, pid, -1, sampletime, proc_uid, add_columns, "[proc_entry_lost(list)]");
+        if (DEBUG) fprintf(stderr, "proc entry disappeared /proc/%d/stat, errno=%s\n", pid, strerror(errno));
+    }
+}
+
+#ifdef HAVE_URING
+
+// one task's worth of batch state for the io_uring engine. the stat/syscall/wchan contents
+// land here straight from the kernel and are handed to outputprocentry() via ctx->pre_*
+#define UB_STATBUF  1024
+#define UB_SYSCBUF  256
+#define UB_WCHANBUF 192
+
+struct ubtask {
+    int pid;
+    int tid;                  // -1 = slot decided not to emit (filtered, lost or container row)
+    uid_t uid;
+    struct fdc_entry *e;
+    int child_lo, child_hi;   // slot range of this process' thread level entries (phase 2)
+    int statn, syscn, wchann; // raw read results filled in by uring_drain()
+    char statb[UB_STATBUF];
+    char syscb[UB_SYSCBUF];
+    char wchanb[UB_WCHANBUF];
+};
+
+int uring_down_warned = 0;    // print the fallback warning only once across all workers
+
+// grow the batch array. queued sqes point into the array, so outstanding reads must be
+// drained before realloc() is allowed to move it
+struct ubtask *ubtasks_grow(struct uring *u, struct ubtask *tasks, int ntasks, int *cap) {
+    if (ntasks < *cap) return tasks;
+    uring_drain(u);
+    *cap = *cap ? *cap * 2 : 1024;
+    tasks = realloc(tasks, *cap * sizeof(struct ubtask));
+    if (!tasks) { fprintf(stderr, "out of memory allocating io_uring batch\n"); exit(1); }
+    return tasks;
+}
+
+// hand one batch slot's pre-read file contents to outputprocentry()
+void uring_emittask(struct capture_ctx *ctx, struct ubtask *t, char *sampletime, char *add_columns) {
+    ctx->pre_stat     = t->statb;
+    ctx->pre_statn    = t->statn;
+    ctx->pre_syscall  = t->syscb;
+    ctx->pre_syscalln = t->syscn > 0 ? fixreadbuf(t->syscb, t->syscn) : -1;
+    ctx->pre_wchan    = t->wchanb;
+    ctx->pre_wchann   = t->wchann > 0 ? fixreadbuf(t->wchanb, t->wchann) : -1;
+    outputprocentry(ctx, t->pid, t->tid, sampletime, t->uid, add_columns);
+}
+
+// sample a slice of the pid listing with batched io_uring reads: one submission wave for the
+// process level stat files, one for the threads of multithreaded processes, one for the
+// syscall+wchan files of tasks that pass the state filter, then format everything.
+// note that with the fd cache in place there is no need for linked open-read-close chains:
+// opens only happen on the first sample a task is seen, everything after that is pure reads
+void uring_sampleslice(struct capture_ctx *ctx, int *pids, int lo, int hi, char *sampletime, char *add_columns) {
+
+    struct uring *u;
+    struct ubtask *tasks = NULL, *t;
+    int cap = 0, ntasks = 0, npidtasks;
+    int i, nthreads;
+    unsigned long long starttime;
+    char dirpath[PATH_MAX];
+    char *fieldend;
+    DIR *td;
+    struct dirent *tde;
+    struct stat st;
+    struct fdc_entry *e;
+
+    // lazily create this thread's ring, falling back to the synchronous engine if the
+    // kernel (or a seccomp policy) does not provide io_uring
+    if (!ctx->ring && !ctx->ring_failed) {
+        ctx->ring = malloc(sizeof(struct uring));
+        if (!ctx->ring || uring_init((struct uring *) ctx->ring)) {
+            free(ctx->ring);
+            ctx->ring = NULL;
+            ctx->ring_failed = 1;
+            if (!uring_down_warned) {
+                uring_down_warned = 1;
+                fprintf(stderr, "io_uring unavailable (%s), falling back to synchronous reads\n", strerror(errno));
+            }
+        }
+    }
+    if (ctx->ring_failed) {
+        for (i = lo; i < hi; i++)
+            sampleprocess(ctx, pids[i], sampletime, add_columns);
+        return;
+    }
+    u = (struct uring *) ctx->ring;
+
+    // phase 1: batch the process level /proc/PID/stat reads for the whole slice
+    for (i = lo; i < hi; i++) {
+        tasks = ubtasks_grow(u, tasks, ntasks, &cap);
+        t = &tasks[ntasks++];
+        t->pid = pids[i];
+        t->tid = 0;
+        t->child_lo = t->child_hi = 0;
+        t->statn = t->syscn = t->wchann = -1;
+        t->uid = -1;
+        t->e = fdc_lookup(t->pid, 0);
+        if (t->e) {
+            if (!fstat(t->e->dirfd, &st)) t->uid = st.st_uid;
+            if (t->e->statfd == -1) t->e->statfd = openat(t->e->dirfd, "stat", O_RDONLY);
+            if (t->e->statfd != -1)
+                uring_queue_read(u, t->e->statfd, t->statb, UB_STATBUF - 1, &t->statn);
+        }
+    }
+    uring_drain(u);
+
+    // phase 2: validate results, enumerate the threads of multithreaded processes and
+    // batch their per-thread stat reads
+    npidtasks = ntasks;
+    for (i = 0; i < npidtasks; i++) {
+        t = &tasks[i];
+        if (!t->e || t->statn <= 0) {
+            outputprocpartial(ctx, t->pid, -1, sampletime, t->uid, add_columns, "[proc_entry_lost(list)]");
+            t->tid = -1;
+            continue;
+        }
+        t->statb[t->statn < UB_STATBUF ? t->statn : UB_STATBUF - 1] = 0;
+
+        starttime = stat_starttime(t->statb);
+        if (!t->e->starttime) {
+            t->e->starttime = starttime;
+        }
+        else if (starttime != t->e->starttime) { // reused pid, drop stale fds and resample synchronously
+            fdc_del(t->e);
+            t->e = NULL;
+            sampleprocess(ctx, t->pid, sampletime, add_columns);
+            t->tid = -1;
+            continue;
+        }
+
+        if ((nfilter_uid && t->uid != (uid_t) -1 && !filter_uid_pass(t->uid)) ||
+            !filter_comm_pass(t->statb)) { // -u / --comm, before the per-thread batches
+            t->tid = -1;
+            continue;
+        }
+
+        fieldend = (char *) stat_field(t->statb, 20);
+        nthreads = fieldend ? atoi(fieldend) : 0;
+        if (nthreads > 1) {
+            sprintf(dirpath, "%s/%d/task", procfs_root, t->pid);
+            td = opendir(dirpath);
+            if (!td) {
+                outputprocpartial(ctx, t->pid, -1, sampletime, t->uid, add_columns, "[task_entry_lost(list)]");
+                t->tid = -1;
+                continue;
+            }
+            t->tid = -1;           // the process level slot itself is not emitted, its threads are
+            t->child_lo = ntasks;  // thread slots are appended contiguously right here
+            while ((tde = readdir(td))) { // proc/PID/task/TID
+                if (tde->d_name[0] >= '0' && tde->d_name[0] <= '9') {
+                    tasks = ubtasks_grow(u, tasks, ntasks, &cap);
+                    t = &tasks[i]; // re-fetch, the grow may have moved the array
+                    struct ubtask *nt = &tasks[ntasks++];
+                    nt->pid = t->pid;
+                    nt->tid = atoi(tde->d_name);
+                    nt->uid = t->uid;
+                    nt->child_lo = nt->child_hi = 0;
+                    nt->statn = nt->syscn = nt->wchann = -1;
+                    nt->e = fdc_lookup(nt->pid, nt->tid);
+                    if (nt->e) {
+                        if (nt->e->statfd == -1) nt->e->statfd = openat(nt->e->dirfd, "stat", O_RDONLY);
+                        if (nt->e->statfd != -1)
+                            uring_queue_read(u, nt->e->statfd, nt->statb, UB_STATBUF - 1, &nt->statn);
+                    }
+                }
+            }
+            closedir(td);
+            t->child_hi = ntasks;
+        }
+        else { // nthreads <= 1, therefore pid == tid
+            t->tid = t->pid;
+        }
+    }
+    uring_drain(u);
+
+    // phase 3: apply the task state filter and batch syscall+wchan reads for survivors
+    for (i = 0; i < ntasks; i++) {
+        t = &tasks[i];
+        if (t->tid == -1) continue;
+
+        if (i >= npidtasks) { // thread level slots were read in phase 2, fix them up here
+            if (!t->e || t->statn <= 0) {
+                outputprocpartial(ctx, t->pid, t->tid, sampletime, t->uid, add_columns, "[task_entry_lost(read)]");
+                t->tid = -1;
+                continue;
+            }
+            t->statb[t->statn < UB_STATBUF ? t->statn : UB_STATBUF - 1] = 0;
+            starttime = stat_starttime(t->statb);
+            if (!t->e->starttime) {
+                t->e->starttime = starttime;
+            }
+            else if (starttime != t->e->starttime) { // reused tid, resample this one synchronously
+                fdc_del(t->e);
+                t->e = NULL;
+                outputprocentry(ctx, t->pid, t->tid, sampletime, t->uid, add_columns);
+                t->tid = -1;
+                continue;
+            }
+        }
+
+        fieldend = (char *) stat_field(t->statb, 3);
+        if (!fieldend) {
+            outputprocpartial(ctx, t->pid, t->tid, sampletime, t->uid, add_columns, "[task_entry_lost(read)]");
+            t->tid = -1;
+            continue;
+        }
+        if (strchr(exclude_states, *fieldend)) {
+            t->tid = -1;
+            continue;
+        }
+
+        e = t->e;
+        if (e->syscallfd == -1) e->syscallfd = openat(e->dirfd, "syscall", O_RDONLY);
+        if (e->syscallfd != -1)
+            uring_queue_read(u, e->syscallfd, t->syscb, UB_SYSCBUF - 1, &t->syscn);
+        if (e->wchanfd == -1) e->wchanfd = openat(e->dirfd, "wchan", O_RDONLY);
+        if (e->wchanfd != -1)
+            uring_queue_read(u, e->wchanfd, t->wchanb, UB_WCHANBUF - 1, &t->wchann);
+    }
+    uring_drain(u);
+
+    // phase 4: format the rows in listing order: each process level slot first, then the
+    // thread slots belonging to it, matching the synchronous engine's output ordering
+    for (i = 0; i < npidtasks; i++) {
+        int j;
+        if (tasks[i].tid != -1)
+            uring_emittask(ctx, &tasks[i], sampletime, add_columns);
+        for (j = tasks[i].child_lo; j < tasks[i].child_hi; j++)
+            if (tasks[j].tid != -1)
+                uring_emittask(ctx, &tasks[j], sampletime, add_columns);
+    }
+    ctx->pre_stat = ctx->pre_syscall = ctx->pre_wchan = NULL;
+
+    free(tasks);
+}
+
+#endif // HAVE_URING
+
+// worker pool for -j N: main thread publishes the pid partition for the sample, workers run
+// sampleprocess() over contiguous slices into per-worker output arenas so that flushing the
+// arenas in worker order keeps the per-sample output ordering stable
+int nworkers = 1;
+int *sample_pids = NULL;
+int sample_npids = 0;
+char *sample_time = NULL;     // timestamp string shared read-only by all workers
+char *sample_columns = NULL;  // add_columns shared read-only by all workers
+int workers_exit = 0;
+pthread_barrier_t start_barrier, done_barrier;
+
+void *worker_main(void *arg) {
+
+    struct worker *w = (struct worker *) arg;
+    struct capture_ctx *ctx = &w->ctx;
+    int i, lo, hi;
+
+    for (;;) {
+        pthread_barrier_wait(&start_barrier);
+        if (workers_exit) break;
+
+        ctx->ob.len = 0;       // reuse the arena allocation across samples
+        ctx->emitted = 0;
+        ctx->dstate = 0;
+        ctx->print_header = 0; // the main thread makes the header decision after the sample
+
+        lo = w->id * sample_npids / nworkers;
+        hi = (w->id + 1) * sample_npids / nworkers;
+#ifdef HAVE_URING
+        if (engine == ENGINE_URING)
+            uring_sampleslice(ctx, sample_pids, lo, hi, sample_time, sample_columns);
+        else
+#endif
+        for (i = lo; i < hi; i++)
+            sampleprocess(ctx, sample_pids[i], sample_time, sample_columns);
+
+        pthread_barrier_wait(&done_barrier); // main flushes the arenas with one writev()
+    }
+    return NULL;
+}
+
+// asynchronous output writer: a dedicated thread drains completed samples so that a
+// slow disk (or NFS-mounted -o directory) stalls the writer, not the sampling loop -
+// output latency must not punch gaps into the capture exactly when the I/O subsystem
+// is struggling. two sample-sized buffers rotate between the sampler and the writer;
+// if the writer still owns both when a sample completes, the sample is dropped and
+// counted rather than blocking the capture timeline
+#define WRITER_BUFS 2
+
+struct obuf writer_buf[WRITER_BUFS];
+long long writer_buf_ts[WRITER_BUFS]; // sample timestamp of each queued buffer, for the time index
+int writer_head = 0;     // next buffer the writer drains
+int writer_nfull = 0;    // completed buffers waiting for the writer
+long writer_dropped = 0; // samples dropped because the writer couldn't keep up
+int writer_exit = 0;
+pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t writer_work = PTHREAD_COND_INITIALIZER;
+pthread_cond_t writer_done = PTHREAD_COND_INITIALIZER;
+
+// per-file time index for bin/xq: one (timestamp, byte offset) entry per sample,
+// collected by the writer thread as it lands buffers and written out as a small
+// <outfile>.xidx sidecar at rotation, so time-range queries can seek instead of scan.
+// disabled for compressed files (byte offsets are meaningless there) and when
+// appending to a pre-existing file (the old extent would be unindexed)
+long long *idx_ts = NULL;
+unsigned long long *idx_off = NULL;
+int idx_n = 0, idx_cap = 0;
+int idx_enabled = 0;              // per output file, decided when the file is opened
+char idx_curfile[PATH_MAX + 8];   // the data file the collected entries belong to,
+                                  // sized to also hold its ".xidx" sidecar name briefly
+
+void idx_add(long long ts_ms, unsigned long long off) {
+    if (idx_n == idx_cap) {
+        idx_cap = idx_cap ? idx_cap * 2 : 4096;
+        idx_ts = realloc(idx_ts, idx_cap * sizeof(long long));
+        idx_off = realloc(idx_off, idx_cap * sizeof(unsigned long long));
+        if (!idx_ts || !idx_off) { fprintf(stderr, "out of memory growing time index\n"); exit(1); }
+    }
+    idx_ts[idx_n] = ts_ms;
+    idx_off[idx_n] = off;
+    idx_n++;
+}
+
+// write the sidecar for the file being rotated away. called from main with the
+// writer drained, nothing touches the index arrays concurrently
+void idx_flush(void) {
+    char path[PATH_MAX + 16];
+    FILE *f;
+    int i;
+
+    if (!idx_enabled || !idx_n) { idx_n = 0; return; }
+    snprintf(path, sizeof(path), "%s.xidx", idx_curfile);
+    f = fopen(path, "w");
+    if (f) {
+        fwrite(XCAP_IDX_MAGIC, 1, 4, f);
+        i = XCAP_IDX_VERSION;
+        fwrite(&i, 4, 1, f);
+        for (i = 0; i < idx_n; i++) {
+            fwrite(&idx_ts[i], 8, 1, f);
+            fwrite(&idx_off[i], 8, 1, f);
+        }
+        fclose(f);
+    }
+    idx_n = 0;
+}
+
+void write_all(int fd, const char *p, size_t len) {
+    ssize_t n;
+    while (len) {
+        n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "output write error='%s'\n", strerror(errno));
+            exit(1);
+        }
+        p += n;
+        len -= (size_t) n;
+    }
+}
+
+// --ship: stream the writer batches to a central collector over TCP instead of the
+// hourly -o files, so ~2000 hosts trickle small continuous transfers instead of
+// rsync'ing multi-gigabyte files at the top of the hour. every batch becomes one
+// length-prefixed frame on the wire:
+//     u32  len     payload bytes that follow the flags byte
+//     u8   flags   1 = the payload is a standalone zstd frame
+//     payload      the same CSV bytes an -o file would get. the first frame of a
+//                  connection carries the column header line
+// unlike the file path, a socket error must never exit(1): the connection is closed,
+// frames spill into a local spool file and reconnects are attempted with backoff,
+// replaying the spool (already framed) first. delivery is at-least-once - a send
+// that dies mid-spool-replay resends the whole spool on the next connect
+#define SHIP_BACKOFF_SEC 5
+#define SHIP_SPOOL_MAX (1LL << 30) // stop spooling past 1 GiB, count drops instead
+
+char *ship_addr = NULL;            // --ship host:port, NULL = mode off
+int ship_fd = -1;
+time_t ship_last_try = 0;          // reconnect backoff timestamp
+char *ship_hdr = NULL;             // header line, sent first on every (re)connect
+int ship_hdrlen = 0;
+char ship_spool[PATH_MAX] = "xcapture_ship.spool";
+long ship_frames_dropped = 0;      // frames lost to a full or unwritable spool
+
+// send() loop that reports errors instead of exiting, MSG_NOSIGNAL so a peer
+// restart doesn't SIGPIPE the sending thread. also used by the --metrics endpoint
+int sock_sendall(int fd, const char *p, size_t len) {
+    ssize_t n;
+    while (len) {
+        n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+int ship_frame_send(const char *p, unsigned int len, unsigned char flags) {
+    unsigned char fhdr[5];
+    memcpy(fhdr, &len, 4);
+    fhdr[4] = flags;
+    if (sock_sendall(ship_fd, (char *) fhdr, 5) || sock_sendall(ship_fd, p, len)) {
+        fprintf(stderr, "ship: send to %s failed - %s, spooling locally\n", ship_addr, strerror(errno));
+        close(ship_fd);
+        ship_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// append one framed batch to the spool file, silently counting drops when the local
+// disk can't take it either - losing frames beats blocking the capture timeline
+void ship_spool_frame(const char *p, unsigned int len, unsigned char flags) {
+    unsigned char fhdr[5];
+    struct stat st;
+    struct iovec iov[2];
+    ssize_t n;
+    int fd;
+
+    if (!stat(ship_spool, &st) && st.st_size >= SHIP_SPOOL_MAX) { ship_frames_dropped++; return; }
+    fd = open(ship_spool, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) { ship_frames_dropped++; return; }
+    memcpy(fhdr, &len, 4);
+    fhdr[4] = flags;
+    iov[0].iov_base = fhdr;
+    iov[0].iov_len = 5;
+    iov[1].iov_base = (char *) p;
+    iov[1].iov_len = len;
+    n = writev(fd, iov, 2); // O_APPEND writev is atomic, no partial frame handling needed
+    if (n != (ssize_t) (len + 5)) ship_frames_dropped++;
+    close(fd);
+}
+
+// replay everything spooled while disconnected - the file already contains framed bytes
+int ship_replay(void) {
+    char buf[1 << 16];
+    ssize_t b;
+    int fd = open(ship_spool, O_RDONLY);
+
+    if (fd < 0) return 0; // nothing spooled
+    while ((b = read(fd, buf, sizeof(buf))) > 0)
+        if (sock_sendall(ship_fd, buf, b)) {
+            close(fd);
+            close(ship_fd);
+            ship_fd = -1;
+            return -1; // spool kept intact, resent in full on the next connect
+        }
+    close(fd);
+    unlink(ship_spool);
+    fprintf(stderr, "ship: reconnected to %s, spool replayed\n", ship_addr);
+    return 0;
+}
+
+int ship_connect(void) {
+    char host[256];
+    char *colon = strrchr(ship_addr, ':');
+    struct addrinfo hints = { 0 }, *res, *ai;
+    struct timeval tmo = { 10, 0 }; // a stuck collector stalls the writer, not the capture
+    time_t now = time(NULL);
+
+    if (ship_fd != -1) return 0;
+    if (now - ship_last_try < SHIP_BACKOFF_SEC) return -1;
+    ship_last_try = now;
+
+    snprintf(host, sizeof(host), "%.*s", (int) (colon - ship_addr), ship_addr);
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &res)) return -1;
+    for (ai = res; ai; ai = ai->ai_next) {
+        ship_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (ship_fd == -1) continue;
+        setsockopt(ship_fd, SOL_SOCKET, SO_SNDTIMEO, &tmo, sizeof(tmo));
+        if (!connect(ship_fd, ai->ai_addr, ai->ai_addrlen)) break;
+        close(ship_fd);
+        ship_fd = -1;
+    }
+    freeaddrinfo(res);
+    if (ship_fd == -1) return -1;
+
+    // every connection opens with the column header so the stream is self-describing
+    if (ship_hdr && ship_frame_send(ship_hdr, ship_hdrlen, 0)) return -1;
+    return ship_replay();
+}
+
+// one completed writer batch in, one frame out (to the socket or the spool)
+void ship_batch(const char *p, size_t len) {
+    const char *payload = p;
+    unsigned int plen = (unsigned int) len;
+    unsigned char flags = 0;
+    char *zbuf = NULL;
+#ifdef HAVE_ZSTD
+    size_t zn, zcap;
+#endif
+
+    if (!len) return;
+#ifdef HAVE_ZSTD
+    zcap = ZSTD_compressBound(len);
+    zbuf = malloc(zcap);
+    if (zbuf) {
+        zn = ZSTD_compress(zbuf, zcap, p, len, 3); // standalone frames, any one is decodable alone
+        if (!ZSTD_isError(zn)) { payload = zbuf; plen = (unsigned int) zn; flags = XCAP_SHIP_ZSTD; }
+    }
+#endif
+    if (ship_connect() || ship_frame_send(payload, plen, flags))
+        ship_spool_frame(payload, plen, flags);
+    free(zbuf);
+    out_written += len;
+}
+
+#ifdef HAVE_ZSTD
+// streaming compression state, only ever touched by the writer thread (or by main
+// while the writer is drained, at rotation). one zstd frame per output file
+ZSTD_CStream *zcs = NULL;
+char zoutbuf[1 << 17];
+
+void zst_begin(void) {
+    if (!zcs) zcs = ZSTD_createCStream();
+    if (!zcs) { fprintf(stderr, "out of memory creating zstd stream\n"); exit(1); }
+    ZSTD_initCStream(zcs, 3); // level 3: ~15x on our CSVs, well below one core
+}
+
+// compress and write a chunk; end != 0 flushes the frame epilogue at rotation
+void zst_sink(const char *p, size_t len, int end) {
+    ZSTD_inBuffer in = { p, len, 0 };
+    ZSTD_outBuffer out;
+    size_t r;
+
+    do {
+        out.dst = zoutbuf;
+        out.size = sizeof(zoutbuf);
+        out.pos = 0;
+        r = ZSTD_compressStream2(zcs, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+        if (ZSTD_isError(r)) {
+            fprintf(stderr, "zstd error='%s'\n", ZSTD_getErrorName(r));
+            exit(1);
+        }
+        write_all(fileno(stdout), zoutbuf, out.pos);
+        out_written += out.pos;
+    } while (in.pos < in.size || (end && r));
+}
+#endif
+
+// --mmap: back each -o output file with a fallocate() preallocation and append by
+// memcpy into a shared mapping instead of write() calls. the kernel flushes the dirty
+// pages in the background - sync_file_range() nudges it every few MiB so the pages
+// trickle out instead of piling up for a writeback storm that co-located latency
+// sensitive workloads would notice. readers (xq, tail -f) see appended bytes through
+// the page cache immediately, no copies. the preallocation is cut back to the bytes
+// actually written when the file is rotated away; a sampler killed mid-hour leaves
+// the full preallocation behind, so appending after a restart first trims the zero
+// tail of a CSV file (CSV content never contains NUL bytes - .xcap records can, so
+// a crashed binary file keeps its zero tail and xcsv stops rendering there).
+// like the zstd stream state, all of this is touched only by the writer thread, or
+// by main at rotation while the writer is drained
+#define MM_CHUNK      (256LL << 20) // preallocation and growth unit without --rotate-mb
+#define MM_SYNC_EVERY (8LL << 20)   // start background writeback every this many new bytes
+
+int use_mmap = 0;        // --mmap
+int mm_fd = -1;
+char *mm_base = NULL;    // mapping of the whole file, [0, mm_size)
+long long mm_size = 0;   // preallocated (and mapped) bytes
+long long mm_start = 0;  // preexisting bytes when appending after a restart
+long long mm_synced = 0; // file offset up to which writeback has been kicked off
+
+// start (but don't wait for) writeback of the pages dirtied since the last call.
+// the partly filled tail page is left alone, it would only get dirtied again
+void mm_writeback(void) {
+    long long end = (mm_start + out_written) & ~4095LL;
+    if (end <= mm_synced) return;
+    sync_file_range(mm_fd, mm_synced, end - mm_synced, SYNC_FILE_RANGE_WRITE);
+    mm_synced = end;
+}
+
+// fallocate reserves the extents up front so writeback never blocks on block
+// allocation; filesystems without it get a plain sparse extension instead
+int mm_reserve(long long from, long long to) {
+    if (!fallocate(mm_fd, 0, from, to - from)) return 0;
+    return errno == EOPNOTSUPP ? ftruncate(mm_fd, to) : -1;
+}
+
+void mm_write(const char *p, size_t len) {
+    long long need = mm_start + out_written + (long long) len;
+    char *newbase;
+
+    if (need > mm_size) { // a batch didn't fit, grow the preallocation
+        long long newsize = mm_size;
+        while (newsize < need) newsize += MM_CHUNK;
+        if (mm_reserve(mm_size, newsize)) {
+            fprintf(stderr, "output fallocate error='%s'\n", strerror(errno));
+            exit(1);
+        }
+        newbase = mremap(mm_base, mm_size, newsize, MREMAP_MAYMOVE);
+        if (newbase == MAP_FAILED) {
+            fprintf(stderr, "output mremap error='%s'\n", strerror(errno));
+            exit(1);
+        }
+        mm_base = newbase;
+        mm_size = newsize;
+    }
+    memcpy(mm_base + mm_start + out_written, p, len);
+    out_written += len;
+    if (mm_start + out_written - mm_synced >= MM_SYNC_EVERY)
+        mm_writeback();
+}
+
+// finalize the file being rotated away: push the remaining dirty pages out, unmap
+// and truncate the preallocation down to the bytes actually written
+void mm_finalize(void) {
+    if (mm_fd == -1) return;
+    if (mm_start + out_written > mm_synced)
+        sync_file_range(mm_fd, mm_synced, mm_start + out_written - mm_synced, SYNC_FILE_RANGE_WRITE);
+    munmap(mm_base, mm_size);
+    if (ftruncate(mm_fd, mm_start + out_written))
+        fprintf(stderr, "output ftruncate error='%s'\n", strerror(errno));
+    close(mm_fd);
+    mm_fd = -1;
+    mm_base = NULL;
+    mm_size = mm_start = mm_synced = 0;
+}
+
+int mm_open(const char *path) {
+    struct stat st;
+    long long want = rotate_bytes ? rotate_bytes : MM_CHUNK;
+
+    mm_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (mm_fd < 0) return -1;
+    if (fstat(mm_fd, &st)) { close(mm_fd); mm_fd = -1; return -1; }
+    mm_start = st.st_size;
+    mm_size = mm_start + want;
+    if (mm_reserve(0, mm_size)) { close(mm_fd); mm_fd = -1; return -1; }
+    mm_base = mmap(NULL, mm_size, PROT_READ | PROT_WRITE, MAP_SHARED, mm_fd, 0);
+    if (mm_base == MAP_FAILED) { mm_base = NULL; close(mm_fd); mm_fd = -1; return -1; }
+    if (output_format != 'B') // zero tail of a killed sampler, CSV only (see above)
+        while (mm_start > 0 && !mm_base[mm_start - 1]) mm_start--;
+    mm_synced = mm_start & ~4095LL;
+    return 0;
+}
+
+// all output funnels through here so the shipped, compressed and plain paths stay in one place
+void output_write(const char *p, size_t len) {
+    if (ship_addr) { ship_batch(p, len); return; }
+    if (mm_base) { mm_write(p, len); return; }
+#ifdef HAVE_ZSTD
+    if (compress_out) { zst_sink(p, len, 0); return; }
+#endif
+    write_all(fileno(stdout), p, len);
+    out_written += len;
+}
+
+void *writer_main(void *arg) {
+
+    struct obuf *ob;
+
+    for (;;) {
+        pthread_mutex_lock(&writer_lock);
+        while (!writer_nfull && !writer_exit)
+            pthread_cond_wait(&writer_work, &writer_lock);
+        if (!writer_nfull && writer_exit) { pthread_mutex_unlock(&writer_lock); break; }
+        ob = &writer_buf[writer_head];
+        pthread_mutex_unlock(&writer_lock);
+
+        // the sampler never touches the buffer at writer_head while writer_nfull > 0,
+        // so the actual write happens without holding the lock
+        if (idx_enabled && ob->len)
+            idx_add(writer_buf_ts[writer_head], out_written);
+        if (stats_every) {
+            unsigned long long t0 = stats_now_us();
+            output_write(ob->buf, ob->len);
+            phist_add(PH_WRITE, stats_now_us() - t0);
+        }
+        else
+            output_write(ob->buf, ob->len);
+
+        pthread_mutex_lock(&writer_lock);
+        ob->len = 0;
+        writer_head = (writer_head + 1) % WRITER_BUFS;
+        writer_nfull--;
+        pthread_cond_signal(&writer_done);
+        pthread_mutex_unlock(&writer_lock);
+    }
+    return NULL;
+}
+
+// wait until everything handed to the writer has hit the output fd. used before the
+// hourly freopen() rotation so no write races the fd swap underneath stdout
+void writer_drain() {
+    pthread_mutex_lock(&writer_lock);
+    while (writer_nfull)
+        pthread_cond_wait(&writer_done, &writer_lock);
+    pthread_mutex_unlock(&writer_lock);
+}
 
-    tid ? sprintf(path, "/proc/%d/task/%d/%s", pid, tid, name) : sprintf(path, "/proc/%d/%s", pid, name);
+// --metrics HTTP endpoint: a minimal single-threaded exposition server on its own
+// aux thread - the capture loop only ever bumps counters and swaps tables, so a slow
+// or stuck scraper can never stall sampling (it only delays other scrapers, briefly,
+// thanks to the socket timeouts). one request per connection, any GET is answered
+// with the Prometheus text format page rendered from the last completed sample.
+// label values are task states, syscall and wchan names - none of those ever contain
+// quotes or backslashes, so no escaping is needed
 
-    fd = open(path, O_RDONLY);
-    if (fd == -1)  { 
-        if (DEBUG) fprintf(stderr, "error opening file %s\n", path); 
-        return -1;
-    }
+void met_counter(struct obuf *page, const char *name, long long v) {
+    char line[128];
+    snprintf(line, sizeof(line), "# TYPE %s counter\n%s %lld\n", name, name, v);
+    ob_str(page, line);
+}
 
-    bytes = read(fd, buf, MAXFILEBUF);
-    close(fd);
-   
-    // handle errors, empty records and missing string terminators in input
-    assert(bytes >= -1);
-    switch (bytes) {
-        case -1:
-            if (DEBUG) fprintf(stderr, "read(%s) returned %d\n", path, bytes);
-            buf[bytes] = '-';
-            buf[bytes + 1] = 0;
-            bytes = 2;
-            break;
-        case 0:
-            buf[bytes] = '-';
-            buf[bytes + 1] = 0;
-            bytes = 2;
-            break;
-        case 1:
-            buf[bytes] = 0;
-            bytes = 2;
-            break;
-        default: // bytes >= 2
-            if (bytes < MAXFILEBUF) 
-                buf[bytes] = 0;
-            else 
-                buf[MAXFILEBUF-1] = 0;
+void met_render(struct obuf *page) {
+    char line[160];
+    unsigned int i;
+    int dim;
+
+    pthread_mutex_lock(&met_lock);
+    for (dim = 0; dim < MET_NDIMS; dim++) {
+        snprintf(line, sizeof(line),
+                 "# HELP xcapture_tasks_%s sampled tasks by %s in the last completed sample\n"
+                 "# TYPE xcapture_tasks_%s gauge\n",
+                 met_dimnames[dim], met_dimnames[dim], met_dimnames[dim]);
+        ob_str(page, line);
+        for (i = 0; met_pub[dim].tab && i < met_pub[dim].cap; i++) {
+            if (!met_pub[dim].tab[i].key[0]) continue;
+            snprintf(line, sizeof(line), "xcapture_tasks_%s{%s=\"%s\"} %ld\n",
+                     met_dimnames[dim], met_dimnames[dim],
+                     met_pub[dim].tab[i].key, met_pub[dim].tab[i].count);
+            ob_str(page, line);
+        }
     }
-    return bytes;
+    snprintf(line, sizeof(line), "# TYPE xcapture_sample_timestamp_seconds gauge\n"
+             "xcapture_sample_timestamp_seconds %lld.%03lld\n", met_ts / 1000, met_ts % 1000);
+    ob_str(page, line);
+    met_counter(page, "xcapture_samples_total", met_samples);
+    met_counter(page, "xcapture_tasks_scanned_total", met_scanned);
+    met_counter(page, "xcapture_rows_emitted_total", met_emitted);
+    met_counter(page, "xcapture_ticks_dropped_total", ticks_dropped);
+    met_counter(page, "xcapture_writer_dropped_samples_total", writer_dropped);
+    if (ship_addr)
+        met_counter(page, "xcapture_ship_dropped_frames_total", ship_frames_dropped);
+    pthread_mutex_unlock(&met_lock);
 }
 
-int outputstack(char *str) {
-    int i;
+void *metrics_main(void *arg) {
+    struct sockaddr_in addr = { 0 };
+    struct timeval tmo = { 2, 0 };
+    struct obuf page = { 0 };
+    char hdr[160], reqbuf[1024];
+    int lfd, cfd, one = 1;
 
-    // find the end and start of function name in the stack
-    // example input lines (different number of fields): 
-    //    [<ffffffff8528428c>] vfs_read+0x8c/0x130
-    //    [<ffffffffc03b03f4>] xfs_file_fsync+0x224/0x240 [xfs]
-    for (i=strlen(str)-1; i>=0; i--) {
-        if (str[i] == '+') str[i] = '\0';
-        if (str[i] == ' ' && str[i-1] == ']') { // ignore spaces _after_ the function name
-            if (strcmp(str+i+1, "entry_SYSCALL_64_after_hwframe") &&
-                strcmp(str+i+1, "do_syscall_64") &&
-                strcmp(str+i+1, "0xffffffffffffffff\n")
-            ) {
-                fprintf(stdout, "->%s()", str+i+1); 
-            }
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0) { fprintf(stderr, "metrics: socket error='%s'\n", strerror(errno)); return NULL; }
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(metrics_port);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) || listen(lfd, 8)) {
+        fprintf(stderr, "metrics: cannot listen on port %d - %s\n", metrics_port, strerror(errno));
+        return NULL;
+    }
+    for (;;) {
+        cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0) continue;
+        setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+        setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tmo, sizeof(tmo));
+        if (read(cfd, reqbuf, sizeof(reqbuf)) > 0) {
+            page.len = 0;
+            met_render(&page);
+            snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n", page.len);
+            if (!sock_sendall(cfd, hdr, strlen(hdr)))
+                sock_sendall(cfd, page.buf, page.len);
         }
+        close(cfd);
     }
-    return 0;
+    return NULL;
 }
 
-// this function changes the input str (tokenizes it in place)
-int outputfields(char *str, char *mask, char *sep) {
-    int i;
-    char *field, *pos;
+// --retain-mb: keep the total size of xcapture output files in the -o directory under
+// the cap by deleting the oldest ones, by mtime (the sequence-suffixed names of size
+// based rotations don't sort chronologically). runs at rotation time, off the sampling path
+void retention_sweep(const char *current) {
 
-    // special case for stack trace handling, we don't want to split the input string before calling outputstack()
-    if (mask[0] == 't')  
-        return outputstack(str);
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    char path[PATH_MAX];
+    char **names = NULL;
+    long long *sizes = NULL, total = 0;
+    time_t *mtimes = NULL;
+    int n = 0, cap = 0, i, j;
+    char *tmp;
+    long long tmpsz;
+    time_t tmpmt;
 
-    for (i=0; i<strlen(mask); i++) {
-        if ((field = strsep(&str, sep)) != NULL) {
-            switch (mask[i]) {
-                case '.': // skip field
-                    break;
-                case 'e': // extract Executable file name from full path
-                    pos = strrchr(field, '/');
-                    if (pos)
-                        fprintf(stdout, "%s%c", pos, outsep);
-                    else 
-                        fprintf(stdout, "%s%c", field, outsep);
-                    break;
-                case 'E': // same as above, but wider output
-                    pos = strrchr(field, '/');
-                    if (pos)
-                        fprintf(stdout, pad ? "%-20s%c" : "%s%c", pos+1, outsep);
-                    else 
-                        fprintf(stdout, pad ? "%-20s%c" : "%s%c", field, outsep);
-                    break;
-                case 'o': // just output string as is
-                    fprintf(stdout, "%s%c", field, outsep);
-                    break;
-                case 'O': // just output string as is, padded to 25 chars
-                    fprintf(stdout, pad ? "%-25s%c" : "%s%c", field, outsep);
-                    break;
-                case 'x': // print in hex
-                    fprintf(stdout, pad ? "0x%llx " : "0x%llx%c", atoll(field), outsep);
-                    break;
-                case 's': // convert syscall number to name, the input starts with either:
-                          //  >= 0 (syscall), -1 (in kernel without syscall) or 'running' (likely userspace)
-                    fprintf(stdout, "%s%c", field[0]=='r' ? "[running]" : field[0]=='-' ? "[no_syscall]" : sysent0[atoi(field)].name, outsep);
-                    break;
-                case 'S': // same as above, but wider output
-                    fprintf(stdout, pad ? "%-25s%c" : "%s%c", field[0]=='r' ? "[running]" : field[0]=='-' ? "[no_syscall]" : sysent0[atoi(field)].name, outsep);
-                    break;
-                case 't': // we shouldn't get here thanks to the if statement above
-                    break;
-                default:
-                    fprintf(stderr, "Error: Wrong char '%c' in mask %s\n", mask[i], mask); 
-                    exit(1);
-             }       
+    if (!retain_bytes) return;
+    d = opendir(output_dir);
+    if (!d) return;
+    while ((de = readdir(d))) {
+        i = strlen(de->d_name);
+        if ((i < 5 || strcmp(de->d_name + i - 4, ".csv")) &&
+            (i < 6 || strcmp(de->d_name + i - 5, ".xcap")) &&
+            (i < 9 || strcmp(de->d_name + i - 8, ".csv.zst")) &&
+            (i < 10 || strcmp(de->d_name + i - 9, ".xcap.zst")))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", output_dir, de->d_name);
+        if (stat(path, &st) || !S_ISREG(st.st_mode)) continue;
+        if (mm_base && current && !strcmp(path, current))
+            st.st_size = mm_start + out_written; // count content, not the --mmap preallocation
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            names = realloc(names, cap * sizeof(char *));
+            sizes = realloc(sizes, cap * sizeof(long long));
+            mtimes = realloc(mtimes, cap * sizeof(time_t));
+            if (!names || !sizes || !mtimes) { closedir(d); free(names); free(sizes); free(mtimes); return; }
         }
-        else break;
+        names[n] = strdup(de->d_name);
+        sizes[n] = st.st_size;
+        mtimes[n] = st.st_mtime;
+        total += st.st_size;
+        n++;
     }
+    closedir(d);
 
-    return i;
-}
+    for (i = 0; i < n; i++) // insertion sort, oldest first - the file count stays small
+        for (j = i; j > 0 && mtimes[j-1] > mtimes[j]; j--) {
+            tmp = names[j-1]; names[j-1] = names[j]; names[j] = tmp;
+            tmpsz = sizes[j-1]; sizes[j-1] = sizes[j]; sizes[j] = tmpsz;
+            tmpmt = mtimes[j-1]; mtimes[j-1] = mtimes[j]; mtimes[j] = tmpmt;
+        }
 
-// currently a fixed string, will make this dynamic together with command line option support
-int outputheader(char *add_columns) {
-
-    fprintf(stdout, pad ? "%-23s %7s %7s %-15s %-2s %-25s %-25s %-25s" : "%s,%s,%s,%s,%s,%s,%s,%s", 
-            output_dir ? "TS" : "DATE       TIME", "PID", "TID", "USERNAME", "ST", "COMMAND", "SYSCALL", "WCHAN");
-    if (strcasestr(add_columns, "exe"))     fprintf(stdout, pad ? " %-20s" : ",%s", "EXE");
-    if (strcasestr(add_columns, "cmdline")) fprintf(stdout, pad ? " %-30s" : ",%s", "CMDLINE");
-    if (strcasestr(add_columns, "kstack"))  fprintf(stdout, pad ? " %s"    : ",%s", "KSTACK");
-    fprintf(stdout, "\n");
-    return 1;
+    for (i = 0; i < n && total > retain_bytes; i++) {
+        snprintf(path, sizeof(path), "%s/%s", output_dir, names[i]);
+        if (current && !strcmp(path, current)) continue; // never the file being written
+        if (!unlink(path)) {
+            total -= sizes[i];
+            fprintf(stderr, "retention: removed %s\n", path);
+            strncat(path, ".xidx", sizeof(path) - strlen(path) - 1);
+            unlink(path); // the time index sidecar goes with its data file
+        }
+    }
+    for (i = 0; i < n; i++) free(names[i]);
+    free(names);
+    free(sizes);
+    free(mtimes);
 }
 
-// partial entry happens when /proc/PID/stat disappears before we manage to read it
-void outputprocpartial(int pid, int tid, char *sampletime, uid_t proc_uid, char *add_columns, char *message) {
+// hand the completed sample over to the writer thread: the per-thread arenas are
+// copied into the next free writer buffer (serial buffer first, then the -j worker
+// arenas in order) and reset for the next sample. the copy is cheap compared to
+// blocking the capture on a write
+void flushsample(struct capture_ctx *serial, struct worker *workers, int blankline) {
+
+    struct obuf *bufs[1025], *dst;
+    int nb = 0, i, w;
 
-    header_printed = header_printed ? 1 : outputheader(add_columns);
+    bufs[nb++] = &serial->ob;
+    if (nworkers > 1)
+        for (w = 0; w < nworkers; w++)
+            bufs[nb++] = &workers[w].ctx.ob;
 
-    fprintf(stdout, pad ? "%-23s %7d %7d %-15s %-2c %-25s %-25s %-25s" : "%s,%d,%d,%s,%c,%s,%s,%s", 
-                    sampletime, pid, tid, getusername(proc_uid), '-', message, "-", "-");
+    pthread_mutex_lock(&writer_lock);
+    if (writer_nfull == WRITER_BUFS) {
+        writer_dropped++;
+        pthread_mutex_unlock(&writer_lock);
+        if (output_format == 'B')
+            dict_rollback(); // the first-sighting dict records went down with the sample
+        fprintf(stderr, "output writer busy, dropped a sample (%ld dropped so far)\n", writer_dropped);
+    }
+    else {
+        dst = &writer_buf[(writer_head + writer_nfull) % WRITER_BUFS];
+        writer_buf_ts[(writer_head + writer_nfull) % WRITER_BUFS] = sample_ts_ms;
+        dst->len = 0;
+        for (i = 0; i < nb; i++)
+            ob_mem(dst, bufs[i]->buf, bufs[i]->len);
+        if (blankline)
+            ob_putc(dst, '\n');
+        writer_nfull++;
+        pthread_cond_signal(&writer_work);
+        pthread_mutex_unlock(&writer_lock);
+        if (output_format == 'B')
+            dict_commit(); // the new dict records are on their way to the file
+    }
 
-    if (strcasestr(add_columns, "exe"))     fprintf(stdout, pad ? " %-20s" : ",%s", "-");
-    if (strcasestr(add_columns, "cmdline")) fprintf(stdout, pad ? " %-30s" : ",%s", "-");
-    if (strcasestr(add_columns, "kstack"))  fprintf(stdout, pad ? " %s"    : ",%s", "-");
-    fprintf(stdout, "\n");
+    for (i = 0; i < nb; i++) bufs[i]->len = 0;
 }
 
-int outputprocentry(int pid, int tid, char *sampletime, uid_t proc_uid, char *add_columns) {
+// --ring flight recorder: keep the last N seconds of formatted samples in a
+// preallocated in-memory ring and do no disk I/O at all until someone asks for the
+// window - either a SIGUSR1 from the outside or the built-in D state trigger firing.
+// meant for always-on capture on latency-sensitive hosts where streaming everything
+// to disk is not acceptable but the last minute before an incident is gold
+int ring_window = 0;            // --ring: seconds of history to keep, 0 = mode off
+int ring_dtrigger = 0;          // --ring-trigger-d: auto-dump when >= N tasks are in D state
+struct ringent { long long ts_ms; struct obuf ob; };
+struct ringent *ringbuf = NULL;
+int ring_slots = 0, ring_head = 0, ring_n = 0;
+volatile sig_atomic_t ring_dump_req = 0;
 
-    int b;
-    char task_status;         // used for early bailout, filtering by task status
-    char sympath[64];
-    char *fieldend;
+void ring_sigusr1(int sig) { ring_dump_req = 1; } // checked once per sample in the main loop
 
-    // if printing out only the /proc/PID entry (not TID), then we have just read the relevant stat file into filebuf
-    // in the calling function. this callflow-dependent optimization avoids an 'expensive' /proc/PID/stat read
-    b = tid ? readfile(pid, tid, "stat", statbuf) : strlen(statbuf); 
-    fieldend = strstr(statbuf, ") ");
+// park the completed sample in the next ring slot, overwriting the oldest one once
+// the window is full. the slot arenas keep their grown capacity across laps, so the
+// steady state allocates nothing
+void ring_store(struct capture_ctx *serial, struct worker *workers) {
 
-    if (b > 0 && fieldend) { // the 1st field end "not null" check is due to /proc not having read consistency (rarely in-flux values are shown as \0\0\0\0\0\0\0...
+    struct obuf *bufs[1025];
+    struct ringent *slot;
+    int nb = 0, i, w;
 
-        // this task_status check operation has to come before any outputfields() calls as they modify filebuf global var
-        task_status = *(fieldend + 2);  // find where the 3rd field - after a ")" starts
+    bufs[nb++] = &serial->ob;
+    if (nworkers > 1)
+        for (w = 0; w < nworkers; w++)
+            bufs[nb++] = &workers[w].ctx.ob;
 
-        if (!strchr(exclude_states, task_status)) {  // task status is not in X,Z,I (S)
+    if (ring_n == ring_slots) {
+        slot = &ringbuf[ring_head];
+        ring_head = (ring_head + 1) % ring_slots;
+    }
+    else
+        slot = &ringbuf[(ring_head + ring_n++) % ring_slots];
 
-            // only print header (in stdout mode) when there are any samples to report
-            header_printed = header_printed ? 1 : outputheader(add_columns);
+    slot->ts_ms = sample_ts_ms;
+    slot->ob.len = 0;
+    for (i = 0; i < nb; i++) {
+        ob_mem(&slot->ob, bufs[i]->buf, bufs[i]->len);
+        bufs[i]->len = 0;
+    }
+}
 
-            fprintf(stdout, pad ? "%-23s %7d %7d %-15s %-2c " : "%s,%d,%d,%s,%c,", sampletime, pid, tid, getusername(proc_uid), task_status); 
-            outputfields(statbuf, ".O", WSP);     // .O......x for PF_ flags
+// write the whole window (oldest sample first) into a fresh timestamped CSV file in
+// the current directory, then restart the window so back to back triggers don't dump
+// the same samples twice
+void ring_dump(const char *reason, char *add_columns) {
 
-            b = readfile(pid, tid, "syscall", filebuf); 
-            if (b > 0) { outputfields(filebuf, "S", WSP); } else { fprintf(stdout, pad ? "%-25s " : "%s,", "-"); }
+    char path[PATH_MAX], timebuf[32];
+    struct obuf hdr = { NULL, 0, 0 };
+    struct tm *tm;
+    time_t now;
+    int fd, i;
 
-            b = readfile(pid, tid, "wchan", filebuf);
-            if (b > 0) { outputfields(filebuf, "O", ". \n"); } else { fprintf(stdout, pad ? "%-25s " : "%s,", "-"); }
+    if (!ring_n) return;
+    now = time(NULL);
+    tm = localtime(&now);
+    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d.%H:%M:%S", tm);
+    snprintf(path, sizeof(path), "xcapture_ring.%s.csv", timebuf);
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ring: error opening dump file %s='%s'\n", path, strerror(errno));
+        return;
+    }
+    outputheader(&hdr, add_columns);
+    write_all(fd, hdr.buf, hdr.len);
+    for (i = 0; i < ring_n; i++)
+        write_all(fd, ringbuf[(ring_head + i) % ring_slots].ob.buf,
+                      ringbuf[(ring_head + i) % ring_slots].ob.len);
+    close(fd);
+    free(hdr.buf);
+    fprintf(stderr, "ring: dumped %d samples to %s (%s)\n", ring_n, path, reason);
+    ring_head = ring_n = 0;
+}
 
-            if (strcasestr(add_columns, "exe")) {
-               tid ? sprintf(sympath, "/proc/%d/task/%d/exe", pid, tid) : sprintf(sympath, "/proc/%d/exe", pid);
-               b = readlink(sympath, filebuf, PATH_MAX);
-               if (b > 0) { filebuf[b] = 0 ; outputfields(filebuf, "E", WSP); } else { fprintf(stdout, pad ? "%-20s " : "%s,", "-"); }
-            }
+// --record: dump every per-task file the sampler reads into a /proc shaped snapshot
+// tree, so a 40k-task production incident becomes a reproducible benchmark input -
+// replay it anywhere with --proc <dir> (see bin/xcapture-bench and 'make bench')
+void record_copyfile(const char *srcdir, const char *dstdir, const char *name, char *buf) {
+    char path[PATH_MAX + 32];
+    int fd, b;
 
-            if (strcasestr(add_columns, "cmdline")) {
-                b = readfile(pid, tid, "cmdline", filebuf); // contains spaces and \0s within data TODO escape (or just print argv[0])
-                if (b > 0) { fprintf(stdout, pad ? "%-30s%c" : "%s%c", filebuf, outsep); } else { fprintf(stdout, pad ? "%-30s%c" : "%s%c", "-", outsep); }
-            }
+    snprintf(path, sizeof(path), "%s/%s", srcdir, name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    b = read(fd, buf, MAXFILEBUF);
+    close(fd);
+    if (b < 0) return;
+    snprintf(path, sizeof(path), "%s/%s", dstdir, name);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    write_all(fd, buf, b);
+    close(fd);
+}
 
-            if (strcasestr(add_columns, "kstack")) {
-                b = readfile(pid, tid, "stack", filebuf); 
-                if (b > 0) { outputfields(filebuf, "t", WSP); } else { fprintf(stdout, "-"); }
-            }
+int record_procfs(const char *dir) {
 
-            fprintf(stdout, "\n");
-        }
-    }
-    else {
-        outputprocpartial(pid, tid, sampletime, proc_uid, add_columns, "[task_entry_lost(read)]");
+    char srcdir[PATH_MAX], dstdir[PATH_MAX], tsrc[PATH_MAX + 16], tdst[PATH_MAX + 16];
+    char linkbuf[PATH_MAX];
+    char *buf;
+    DIR *pd, *td;
+    struct dirent *pde, *tde;
+    int pid, b, npids = 0, ntids = 0;
+
+    buf = malloc(MAXFILEBUF);
+    if (!buf) { fprintf(stderr, "out of memory allocating record buffer\n"); return 1; }
+    if (mkdir(dir, 0755) && errno != EEXIST) {
+        fprintf(stderr, "Error creating snapshot directory %s - %s\n", dir, strerror(errno));
         return 1;
     }
+    pd = opendir(procfs_root);
+    if (!pd) { fprintf(stderr, "%s listing error='%s'\n", procfs_root, strerror(errno)); return 1; }
+
+    while ((pde = readdir(pd))) {
+        if (pde->d_name[0] < '0' || pde->d_name[0] > '9') continue;
+        pid = atoi(pde->d_name);
+        snprintf(srcdir, sizeof(srcdir), "%s/%d", procfs_root, pid);
+        snprintf(dstdir, sizeof(dstdir), "%s/%d", dir, pid);
+        if (mkdir(dstdir, 0755) && errno != EEXIST) continue;
+        npids++;
+        record_copyfile(srcdir, dstdir, "stat", buf);
+        record_copyfile(srcdir, dstdir, "cmdline", buf);
+        snprintf(tsrc, sizeof(tsrc), "%s/exe", srcdir);
+        b = readlink(tsrc, linkbuf, sizeof(linkbuf) - 1);
+        if (b > 0) {
+            linkbuf[b] = 0;
+            snprintf(tdst, sizeof(tdst), "%s/exe", dstdir);
+            symlink(linkbuf, tdst); // keep exe a symlink, the sampler readlink()s it
+        }
 
+        snprintf(tsrc, sizeof(tsrc), "%s/task", srcdir);
+        snprintf(tdst, sizeof(tdst), "%s/task", dstdir);
+        if (mkdir(tdst, 0755) && errno != EEXIST) continue;
+        td = opendir(tsrc);
+        if (!td) continue;
+        while ((tde = readdir(td))) {
+            if (tde->d_name[0] < '0' || tde->d_name[0] > '9') continue;
+            snprintf(tsrc, sizeof(tsrc), "%s/%d/task/%s", procfs_root, pid, tde->d_name);
+            snprintf(tdst, sizeof(tdst), "%s/%d/task/%s", dir, pid, tde->d_name);
+            if (mkdir(tdst, 0755) && errno != EEXIST) continue;
+            ntids++;
+            record_copyfile(tsrc, tdst, "stat", buf);
+            record_copyfile(tsrc, tdst, "syscall", buf);
+            record_copyfile(tsrc, tdst, "wchan", buf);
+            record_copyfile(tsrc, tdst, "stack", buf);
+            record_copyfile(tsrc, tdst, "schedstat", buf);
+            snprintf(tsrc, sizeof(tsrc), "%s/%d/task/%s/exe", procfs_root, pid, tde->d_name);
+            b = readlink(tsrc, linkbuf, sizeof(linkbuf) - 1);
+            if (b > 0) {
+                linkbuf[b] = 0;
+                strncat(tdst, "/exe", sizeof(tdst) - strlen(tdst) - 1);
+                symlink(linkbuf, tdst);
+            }
+            snprintf(tsrc, sizeof(tsrc), "%s/%d/task/%s", procfs_root, pid, tde->d_name);
+        }
+        closedir(td);
+    }
+    closedir(pd);
+    free(buf);
+    fprintf(stderr, "recorded %d processes, %d tasks into %s\n", npids, ntids, dir);
     return 0;
 }
 
+void stats_report(void) {
+    int ph;
+    fprintf(stderr, "xcapture-stats: ts=%lld samples=%d scanned=%ld emitted=%ld"
+            " ticks_dropped=%ld writer_dropped=%ld",
+            sample_ts_ms, stats_samples, stats_scanned, stats_emitted,
+            ticks_dropped, writer_dropped);
+    for (ph = 0; ph < PH_NPHASES; ph++) {
+        if (!phases[ph].count) continue;
+        fprintf(stderr, " %s_n=%llu %s_avgus=%llu %s_p50us=%llu %s_p99us=%llu",
+                phase_names[ph], phases[ph].count,
+                phase_names[ph], phases[ph].sum / phases[ph].count,
+                phase_names[ph], phist_pct(&phases[ph], 50),
+                phase_names[ph], phist_pct(&phases[ph], 99));
+    }
+    fprintf(stderr, "\n");
+    memset(phases, 0, sizeof(phases)); // histograms cover one window each,
+    stats_scanned = stats_emitted = 0; // the tick/drop counters stay cumulative
+    stats_samples = 0;
+}
+
 void printhelp() {
     const char *helptext =
     "by Tanel Poder [https://0x.tools]\n\n"
@@ -283,48 +3747,260 @@ void printhelp() {
     "  Options:\n"
     "    -a             capture tasks in additional states, even the ones Sleeping (S)\n"
     "    -A             capture tasks in All states, including Zombie (Z), Exiting (X), Idle (I)\n"
-    "    -c <c1,c2>     print additional columns (for example: -c exe,cmdline,kstack)\n"
+    "    -c <c1,c2>     print additional columns, available: exe, cmdline, kstack, the\n"
+    "                   stat-derived cputime, flt, rss, prio, cpuid and schedstat (CPU%%/LAT%%\n"
+    "                   run-queue latency deltas, the native replacement for bin/schedlat)\n"
     "    -d <N>         seconds between samples (default: 1.0)\n"
     "    -E <string>    custom task state Exclusion filter (default: XZIS)\n"
+    "    -F <format>    output file format for -o: csv (default) or binary, the compact\n"
+    "                   dictionary-encoded format (render back to CSV with bin/xcsv)\n"
     "    -h             display this help message\n"
+    "    -j <N>         sample with N parallel worker threads (default: 1)\n"
+    "    -p <p1,p2>     only sample these pids (compiled into a bitmap, checked before\n"
+    "                   any per-task read)\n"
+    "    -u <u1,u2>     only sample tasks of these users (names or numeric uids)\n"
+    "    --comm=<glob>  only sample processes whose comm matches this glob, e.g. 'mysql*'\n"
+    "    --syscall=<s1,s2> only emit rows in these syscalls (names, plus the special\n"
+    "                   values 'running' and 'none')\n"
+    "    --engine=<e>   capture engine: proc (default), uring (batched io_uring reads)\n"
+    "                   or bpf (one-pass BPF task iterator, needs a 'make ebpf' build)\n"
+    "    --tasklist=<t> pid listing mode: scan (default) or netlink (incremental proc connector)\n"
+    "    --cgroup=<dir> only sample tasks in this cgroup subtree (cgroup.procs enumeration\n"
+    "                   instead of the full /proc walk), path relative to /sys/fs/cgroup or absolute\n"
+    "    --compress     write -o files zstd-compressed (.zst), needs a 'make zstd' build\n"
+    "    --rotate-mb=<N> rotate the -o output file when it reaches N MiB (plus hourly)\n"
+    "    --retain-mb=<N> delete oldest -o output files when the directory total exceeds N MiB\n"
+    "    --mmap         append to fallocate()-preallocated -o files through a memory mapping\n"
+    "                   with paced background writeback instead of write() calls\n"
+    "    --ship=<host:port> stream sample batches to a central collector as length-prefixed\n"
+    "                   (zstd-compressed in 'make zstd' builds) frames over TCP instead of\n"
+    "                   -o files, spooling into ./xcapture_ship.spool while disconnected\n"
+    "    --ring=<sec>   flight recorder: keep the last <sec> seconds of samples in memory only\n"
+    "                   and dump the window to a xcapture_ring.*.csv file on SIGUSR1\n"
+    "    --ring-trigger-d=<N> also dump the ring when N or more sampled tasks are in D state\n"
+    "    --summary=<N>  print psn-style rollups of (state, comm, syscall, wchan [, kstack])\n"
+    "                   every N samples instead of raw sample lines\n"
+    "    --delta=<N>    only write a task's row when its (state, syscall, wchan [, kstack])\n"
+    "                   tuple changed, with a trailing SAMPLES count column and a keepalive\n"
+    "                   row every N suppressed samples (sum SAMPLES to get occupancy)\n"
+    "    --metrics=<port> serve Prometheus-style task counts by state, syscall and wchan\n"
+    "                   plus sampler counters over HTTP (scraped from an aux thread,\n"
+    "                   never the sampling loop)\n"
+    "    --tiered=<K,N> demote processes idle for K consecutive samples to a slow tier\n"
+    "                   re-checked every Nth sample only (--tiered=10 means K=N=10)\n"
+    "    --stats=<N>    report sampler self-statistics (per-phase latency histograms,\n"
+    "                   scan/emit/overrun counters) to stderr every N samples\n"
+    "    --record=<dir> dump the per-task files the sampler reads into a /proc shaped\n"
+    "                   snapshot tree and exit (benchmark input, see 'make bench')\n"
+    "    --proc=<dir>   sample this tree instead of /proc, e.g. a --record snapshot\n"
     "    -o <dirname>   write wide output into hourly CSV files in this directory instead of stdout\n";
 
     fprintf(stderr, "\n0x.Tools xcapture v%s %s\n", XCAP_VERSION, helptext);
 }
 
-float timedifference_msec(struct timeval t0, struct timeval t1)
-{
-    return (t1.tv_sec - t0.tv_sec) * 1000.0f + (t1.tv_usec - t0.tv_usec) / 1000.0f;
+void ts_addmsec(struct timespec *ts, long msec) {
+    ts->tv_sec += msec / 1000;
+    ts->tv_nsec += (msec % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
 }
 
 int main(int argc, char **argv)
 {
-    char outbuf[BUFSIZ];
     char outpath[PATH_MAX];
-    char dirpath[PATH_MAX]; // used for /proc stuff only, so no long paths
-    DIR *pd, *td;
-    struct dirent *pde, *tde; // process level and thread/task level directory entries in /proc
+    DIR *pd;
+    struct dirent *pde;       // process level directory entries in /proc
+
+    struct capture_ctx serial_ctx = { .print_header = 1 }; // used when -j 1 (default)
+    char want_format = 0;      // -F override, applied after all options are parsed
+    struct worker *workers = NULL;
+    int *pids = NULL;         // pid listing of the current sample
+    int npids, pids_cap = 0;
+    long total_emitted;
+    int w, i;
 
     char timebuf[80], usec_buf[6];
-    struct timeval tmnow,loop_iteration_start_time,loop_iteration_end_time;
-    float loop_iteration_msec;
-    float sleep_for_msec;
+    struct timeval tmnow;
+    struct timespec deadline, mono_now; // absolute-deadline sampling schedule, CLOCK_MONOTONIC
+    int overrun;
+    unsigned long long phase_t0 = 0; // --stats: start of the pid listing phase
     struct tm *tm;
     int prevhour = -1; // used for detecting switch to a new hour for creating a new output file
     int interval_msec = 1000;
 
-    struct stat s;
-    uid_t proc_uid;
-
-    int nthreads = 0;
     int mypid = getpid();
+    struct rlimit rl;
+    struct stat outstat;
+    int rescan_countdown = 0; // --tasklist=netlink: 0 forces the initial full scan
+    pthread_t uidc_resolver;
+    pthread_t writer_thread;
+    pthread_t metrics_thread;
 
     // argument handling
     char *add_columns = "";   // keep "" as a default value and not NULL
+    char *record_dir = NULL;  // --record: dump a procfs snapshot and exit
     int c;
+    int option_index = 0;
+    static struct option long_options[] = {
+        {"engine",    required_argument, NULL, 0},
+        {"tasklist",  required_argument, NULL, 0},
+        {"cgroup",    required_argument, NULL, 0},
+        {"comm",      required_argument, NULL, 0},
+        {"syscall",   required_argument, NULL, 0},
+        {"compress",  no_argument,       NULL, 0},
+        {"rotate-mb", required_argument, NULL, 0},
+        {"retain-mb", required_argument, NULL, 0},
+        {"mmap",      no_argument,       NULL, 0},
+        {"ship",      required_argument, NULL, 0},
+        {"ring",      required_argument, NULL, 0},
+        {"ring-trigger-d", required_argument, NULL, 0},
+        {"summary",   required_argument, NULL, 0},
+        {"delta",     required_argument, NULL, 0},
+        {"metrics",   required_argument, NULL, 0},
+        {"tiered",    required_argument, NULL, 0},
+        {"stats",     required_argument, NULL, 0},
+        {"record",    required_argument, NULL, 0},
+        {"proc",      required_argument, NULL, 0},
+        {NULL, 0, NULL, 0}
+    };
 
-    while ((c = getopt (argc, argv, "aAc:d:E:ho:")) != -1)
+    while ((c = getopt_long(argc, argv, "aAc:d:E:F:hj:o:p:u:", long_options, &option_index)) != -1)
         switch (c) {
+            case 0: // long options
+                if (!strcmp(long_options[option_index].name, "engine")) {
+                    if (!strcmp(optarg, "proc")) {
+                        engine = ENGINE_PROC;
+                    }
+                    else if (!strcmp(optarg, "uring")) {
+#ifdef HAVE_URING
+                        engine = ENGINE_URING;
+#else
+                        fprintf(stderr, "This build has no io_uring support, using --engine=proc\n");
+#endif
+                    }
+                    else if (!strcmp(optarg, "bpf")) {
+#ifdef HAVE_LIBBPF
+                        engine = ENGINE_BPF;
+#else
+                        fprintf(stderr, "This build has no eBPF support (build with make ebpf), using --engine=proc\n");
+#endif
+                    }
+                    else {
+                        fprintf(stderr, "Option --engine has invalid value - %s (proc, uring, bpf)\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "tasklist")) {
+                    if (!strcmp(optarg, "scan")) {
+                        tasklist_mode = TASKLIST_SCAN;
+                    }
+                    else if (!strcmp(optarg, "netlink")) {
+                        tasklist_mode = TASKLIST_NETLINK;
+                    }
+                    else {
+                        fprintf(stderr, "Option --tasklist has invalid value - %s (scan, netlink)\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "cgroup")) {
+                    cgroup_dir = optarg;
+                }
+                else if (!strcmp(long_options[option_index].name, "comm")) {
+                    filter_comm = optarg;
+                }
+                else if (!strcmp(long_options[option_index].name, "syscall")) {
+                    if (filter_parse_syscalls(optarg)) {
+                        fprintf(stderr, "Option --syscall has invalid value\n");
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "compress")) {
+#ifdef HAVE_ZSTD
+                    compress_out = 1;
+#else
+                    fprintf(stderr, "This build has no zstd support (build with make zstd)\n");
+                    return 1;
+#endif
+                }
+                else if (!strcmp(long_options[option_index].name, "rotate-mb")) {
+                    rotate_bytes = atoll(optarg) * 1024 * 1024;
+                    if (rotate_bytes <= 0) {
+                        fprintf(stderr, "Option --rotate-mb has invalid value - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "retain-mb")) {
+                    retain_bytes = atoll(optarg) * 1024 * 1024;
+                    if (retain_bytes <= 0) {
+                        fprintf(stderr, "Option --retain-mb has invalid value - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "mmap")) {
+                    use_mmap = 1;
+                }
+                else if (!strcmp(long_options[option_index].name, "ship")) {
+                    ship_addr = optarg;
+                }
+                else if (!strcmp(long_options[option_index].name, "ring")) {
+                    ring_window = atoi(optarg);
+                    if (ring_window <= 0 || ring_window > 3600) {
+                        fprintf(stderr, "Option --ring has invalid value for window seconds - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "ring-trigger-d")) {
+                    ring_dtrigger = atoi(optarg);
+                    if (ring_dtrigger <= 0) {
+                        fprintf(stderr, "Option --ring-trigger-d has invalid value - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "summary")) {
+                    summary_every = atoi(optarg);
+                    if (summary_every <= 0) {
+                        fprintf(stderr, "Option --summary has invalid value for sample count - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "delta")) {
+                    delta_keepalive = atoi(optarg);
+                    if (delta_keepalive <= 0) {
+                        fprintf(stderr, "Option --delta has invalid value for keepalive sample count - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "metrics")) {
+                    metrics_port = atoi(optarg);
+                    if (metrics_port <= 0 || metrics_port > 65535) {
+                        fprintf(stderr, "Option --metrics has invalid value for port - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "tiered")) {
+                    if (sscanf(optarg, "%d,%d", &tiered_k, &tiered_n) == 1)
+                        tiered_n = tiered_k; // single value sets both thresholds
+                    if (tiered_k < 1 || tiered_n < 2) {
+                        fprintf(stderr, "Option --tiered has invalid value - %s (want K>=1,N>=2)\n", optarg);
+                        return 1;
+                    }
+                }
+                else if (!strcmp(long_options[option_index].name, "record")) {
+                    record_dir = optarg;
+                }
+                else if (!strcmp(long_options[option_index].name, "proc")) {
+                    procfs_root = optarg;
+                }
+                else if (!strcmp(long_options[option_index].name, "stats")) {
+                    stats_every = atoi(optarg);
+                    if (stats_every <= 0) {
+                        fprintf(stderr, "Option --stats has invalid value for sample count - %s\n", optarg);
+                        return 1;
+                    }
+                }
+                break;
             case 'a':
                 strncpy(exclude_states, "XZI", sizeof(exclude_states));
                 break;
@@ -348,6 +4024,33 @@ int main(int argc, char **argv)
                 printhelp();
                 exit(1);
                 break;
+            case 'p':
+                if (filter_parse_pids(optarg)) {
+                    fprintf(stderr, "Option -p has invalid value for pid list - %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'u':
+                if (filter_parse_users(optarg)) {
+                    fprintf(stderr, "Option -u has invalid value for user list - %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'j':
+                nworkers = atoi(optarg);
+                if (nworkers < 1 || nworkers > 1024) {
+                    fprintf(stderr, "Option -j has invalid value for worker thread count - %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'F':
+                if (!strcmp(optarg, "csv")) want_format = 'C';
+                else if (!strcmp(optarg, "binary")) want_format = 'B';
+                else {
+                    fprintf(stderr, "Option -F has invalid value, use csv or binary - %s\n", optarg);
+                    return 1;
+                }
+                break;
             case 'o':
                 output_dir = optarg;
                 output_format = 'C'; // CSV
@@ -356,7 +4059,7 @@ int main(int argc, char **argv)
                 if (!strlen(add_columns)) add_columns = "exe,kstack";
                 break;
             case '?':
-                if (strchr("cEd", optopt))
+                if (strchr("cEdjFpu", optopt))
                     fprintf(stderr, "Option -%c requires an argument.\n", optopt);
                 else if (isprint (optopt))
                     fprintf(stderr, "Unknown option `-%c'.\n", optopt);
@@ -368,28 +4071,245 @@ int main(int argc, char **argv)
         }
     // end argument handling
 
-    setbuf(stdout, outbuf);
+    if ((compress_out || rotate_bytes || retain_bytes || use_mmap) && !output_dir) {
+        fprintf(stderr, "Options --compress, --rotate-mb, --retain-mb and --mmap require an output directory (-o)\n");
+        return 1;
+    }
+    if (use_mmap && compress_out) {
+        fprintf(stderr, "Option --mmap appends the final file bytes through a mapping, not combined with --compress\n");
+        return 1;
+    }
+
+    if (record_dir)
+        return record_procfs(record_dir);
+
+    if (cgroup_dir) {
+        static char cgpath[PATH_MAX]; // options point into argv, this one may need a prefix
+        if (cgroup_dir[0] != '/') {
+            snprintf(cgpath, sizeof(cgpath), "/sys/fs/cgroup/%s", cgroup_dir);
+            cgroup_dir = cgpath;
+        }
+        snprintf(outpath, sizeof(outpath), "%s/cgroup.procs", cgroup_dir);
+        if (stat(outpath, &outstat)) {
+            fprintf(stderr, "Option --cgroup: no cgroup.procs under %s - %s\n", cgroup_dir, strerror(errno));
+            return 1;
+        }
+        if (tasklist_mode == TASKLIST_NETLINK) {
+            fprintf(stderr, "Option --cgroup already avoids the /proc walk, not combined with --tasklist=netlink\n");
+            return 1;
+        }
+    }
+
+    if (summary_every && (output_dir || ring_window)) {
+        fprintf(stderr, "Option --summary prints to stdout only, not with -o or --ring\n");
+        return 1;
+    }
+    if (summary_every && engine == ENGINE_BPF) {
+        fprintf(stderr, "Option --summary is not supported with --engine=bpf yet\n");
+        return 1;
+    }
+    if (tiered_k && engine == ENGINE_BPF) {
+        fprintf(stderr, "Option --tiered has no effect with --engine=bpf (no per-pid reads), ignoring\n");
+        tiered_k = tiered_n = 0;
+    }
+
+    if (ring_dtrigger && !ring_window) {
+        fprintf(stderr, "Option --ring-trigger-d requires --ring\n");
+        return 1;
+    }
+    if (ring_window && output_dir) {
+        fprintf(stderr, "Options --ring and -o are mutually exclusive (the ring dumps its own files)\n");
+        return 1;
+    }
+    if (ring_window) {
+        output_format = 'C'; // the dump files are CSV, formatted like -o output
+        outsep = ',';
+        pad = 0;
+        serial_ctx.print_header = 0; // the header goes into the dump file, not every sample
+        if (!strlen(add_columns)) add_columns = "exe,kstack";
+    }
+
+    if (want_format == 'B') {
+        if (!output_dir) {
+            fprintf(stderr, "Option -F binary requires an output directory (-o)\n");
+            return 1;
+        }
+        if (engine == ENGINE_BPF) {
+            fprintf(stderr, "Option -F binary is not supported with --engine=bpf yet\n");
+            return 1;
+        }
+        output_format = 'B';
+    }
+
+    if (delta_keepalive) {
+        if (want_format == 'B') {
+            fprintf(stderr, "Option --delta is not supported with -F binary (the format has no SAMPLES field)\n");
+            return 1;
+        }
+        if (summary_every) {
+            fprintf(stderr, "Option --delta makes no sense with --summary, the rollups already suppress rows\n");
+            return 1;
+        }
+        if (engine == ENGINE_BPF) {
+            fprintf(stderr, "Option --delta is not supported with --engine=bpf yet\n");
+            return 1;
+        }
+    }
+
+    if (metrics_port && engine == ENGINE_BPF) {
+        fprintf(stderr, "Option --metrics is not supported with --engine=bpf yet\n");
+        return 1;
+    }
+
+    if (ship_addr) {
+        char *colon = strrchr(ship_addr, ':');
+        static struct obuf ship_hdrbuf = { 0 }; // outlives main's option handling
+        if (!colon || colon == ship_addr || !colon[1]) {
+            fprintf(stderr, "Option --ship needs host:port - %s\n", ship_addr);
+            return 1;
+        }
+        if (output_dir || ring_window || summary_every) {
+            fprintf(stderr, "Option --ship replaces -o, not combined with -o, --ring or --summary\n");
+            return 1;
+        }
+        if (compress_out) {
+            fprintf(stderr, "Option --ship frames compress themselves, not combined with --compress\n");
+            return 1;
+        }
+        outsep = ',';  // the wire payload is CSV, formatted like the -o files
+        pad = 0;
+        serial_ctx.print_header = 0; // the header opens every connection instead
+        if (!strlen(add_columns)) add_columns = "exe,kstack";
+        outputheader(&ship_hdrbuf, add_columns);
+        ship_hdr = ship_hdrbuf.buf;
+        ship_hdrlen = ship_hdrbuf.len;
+    }
+
+    if (ring_window) {
+        ring_slots = ring_window * 1000 / interval_msec + 1;
+        if (ring_slots < 2) ring_slots = 2;
+        ringbuf = calloc(ring_slots, sizeof(struct ringent));
+        if (!ringbuf) { fprintf(stderr, "out of memory allocating the sample ring\n"); exit(1); }
+        signal(SIGUSR1, ring_sigusr1);
+    }
+
+    if (pthread_create(&uidc_resolver, NULL, uidc_resolver_main, NULL) ||
+        pthread_create(&writer_thread, NULL, writer_main, NULL) ||
+        (metrics_port && pthread_create(&metrics_thread, NULL, metrics_main, NULL))) {
+        fprintf(stderr, "pthread_create error='%s'\n", strerror(errno));
+        exit(1);
+    }
+
+    // the fd cache keeps several fds per live task, so raise the fd limit as far as allowed
+    if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) && DEBUG)
+            fprintf(stderr, "setrlimit(RLIMIT_NOFILE) error='%s'\n", strerror(errno));
+    }
+
+#ifdef HAVE_LIBBPF
+    if (engine == ENGINE_BPF && bpf_engine_init()) {
+        fprintf(stderr, "falling back to --engine=proc\n");
+        engine = ENGINE_PROC;
+    }
+#endif
+
+    if (tasklist_mode == TASKLIST_NETLINK && cn_connect()) {
+        fprintf(stderr, "proc connector unavailable (%s, needs root), falling back to --tasklist=scan\n", strerror(errno));
+        tasklist_mode = TASKLIST_SCAN;
+    }
+
+    if (nworkers > 1) {
+        workers = calloc(nworkers, sizeof(struct worker));
+        if (!workers) { fprintf(stderr, "out of memory allocating workers\n"); exit(1); }
+        pthread_barrier_init(&start_barrier, NULL, nworkers + 1);
+        pthread_barrier_init(&done_barrier, NULL, nworkers + 1);
+        for (w = 0; w < nworkers; w++) {
+            workers[w].id = w;
+            if (pthread_create(&workers[w].thread, NULL, worker_main, &workers[w])) {
+                fprintf(stderr, "pthread_create error='%s'\n", strerror(errno)); exit(1);
+            }
+        }
+    }
 
     fprintf(stderr, "\n0xTools xcapture v%s by Tanel Poder [https://0x.tools]\n\nSampling /proc...\n\n", XCAP_VERSION);
 
+    clock_gettime(CLOCK_MONOTONIC, &deadline); // the sampling grid starts here
+
     while (1) {
 
         gettimeofday(&tmnow, NULL);
-        gettimeofday(&loop_iteration_start_time, NULL);
         tm = localtime(&tmnow.tv_sec);
+        sample_ts_ms = (long long) tmnow.tv_sec * 1000 + tmnow.tv_usec / 1000;
+
+        fdc_gen++; // new sample generation, entries not touched this round get evicted below
+        serial_ctx.dstate = 0;
+        serial_ctx.emitted = 0;
 
         if (output_dir) {
-            if (prevhour != tm->tm_hour) {
+            if (prevhour != tm->tm_hour || (rotate_bytes && out_written >= rotate_bytes)) {
+                writer_drain(); // no in-flight writes may race the fd swap below
+#ifdef HAVE_ZSTD
+                if (compress_out && zcs && out_written)
+                    zst_sink(NULL, 0, 1); // close the zstd frame of the previous file
+#endif
+                // size-based rotations within the hour get a sequence suffix, the plain
+                // hourly name stays unchanged for existing downstream consumers
+                rotate_seq = (prevhour == tm->tm_hour) ? rotate_seq + 1 : 0;
                 strftime(timebuf, 30, "%Y-%m-%d.%H", tm);
-                snprintf(outpath, sizeof(outpath), "%s/%s.csv", output_dir, timebuf);
-                if (!freopen(outpath, "a", stdout)) { fprintf(stderr, "Error opening output file\n"); exit(1); };
-                setbuf(stdout, outbuf); // is this needed after freopen?
+                if (rotate_seq)
+                    snprintf(outpath, sizeof(outpath), "%s/%s.%02d.%s%s", output_dir, timebuf, rotate_seq,
+                             output_format == 'B' ? "xcap" : "csv", compress_out ? ".zst" : "");
+                else
+                    snprintf(outpath, sizeof(outpath), "%s/%s.%s%s", output_dir, timebuf,
+                             output_format == 'B' ? "xcap" : "csv", compress_out ? ".zst" : "");
+                // never append to an existing binary file: the restarted run's dictionary
+                // ids would redefine the previous run's and xcsv renders last-definition
+                // wins, silently rewriting the older rows' strings. take the next free
+                // sequence suffix instead
+                if (output_format == 'B')
+                    while (!stat(outpath, &outstat) && outstat.st_size > 0) {
+                        rotate_seq++;
+                        snprintf(outpath, sizeof(outpath), "%s/%s.%02d.xcap%s", output_dir,
+                                 timebuf, rotate_seq, compress_out ? ".zst" : "");
+                    }
+                idx_flush(); // sidecar for the file rotated away, written while drained
+                if (use_mmap) {
+                    mm_finalize(); // truncates the previous file's preallocation
+                    if (mm_open(outpath)) { fprintf(stderr, "Error opening output file - %s\n", strerror(errno)); exit(1); }
+                }
+                else if (!freopen(outpath, "a", stdout)) { fprintf(stderr, "Error opening output file\n"); exit(1); };
+                out_written = 0;
+                // index only fresh uncompressed files: offsets into an appended-to or
+                // compressed file would not line up with what a reader can seek to
+                idx_enabled = use_mmap ? !mm_start
+                                       : !compress_out && !fstat(fileno(stdout), &outstat) && outstat.st_size == 0;
+                strncpy(idx_curfile, outpath, sizeof(idx_curfile) - 1);
+                if (!idx_enabled) { // drop a stale sidecar of a file we now append to
+                    snprintf(idx_curfile, sizeof(idx_curfile), "%s.xidx", outpath);
+                    unlink(idx_curfile);
+                    strncpy(idx_curfile, outpath, sizeof(idx_curfile) - 1);
+                }
+#ifdef HAVE_ZSTD
+                if (compress_out) zst_begin(); // one frame per output file
+#endif
                 prevhour = tm->tm_hour;
-                header_printed = outputheader(add_columns);
+                if (output_format == 'B') {
+                    // string ids restart per file - the suffix scan above guarantees
+                    // the file is fresh, so it always gets its own header
+                    dict_clear();
+                    bin_filehdr(&serial_ctx.ob, add_columns);
+                    header_printed = 1;
+                }
+                else
+                    header_printed = outputheader(&serial_ctx.ob, add_columns); // flushed before the worker arenas
+                retention_sweep(outpath);
             }
         }
         else {
-            header_printed = 0; // dynamic stdout header printing decision is made later on
+            // ring mode pretends the header was printed, the dump writes its own;
+            // plain stdout mode makes the dynamic header decision later on
+            header_printed = ring_window ? 1 : 0;
         }
 
         strftime(timebuf, 30, pad ? "%Y-%m-%d %H:%M:%S" : "%Y-%m-%d %H:%M:%S", tm); // currently same format for both outputs
@@ -397,59 +4317,157 @@ int main(int argc, char **argv)
         sprintf(usec_buf, "%03d", (int)tmnow.tv_usec/1000); // ms resolution should be ok for infrequent sampling
         strcat(timebuf, usec_buf);
 
-        pd = opendir("/proc");
-        if (!pd) { fprintf(stderr, "/proc listing error='%s', this shouldn't happen\n", strerror(errno)); exit(1); } 
+#ifdef HAVE_LIBBPF
+        if (engine == ENGINE_BPF) {
+            // the iterator covers all tasks in one kernel pass, no pid listing needed
+            bpf_sample(&serial_ctx, timebuf, add_columns);
+            goto sample_done;
+        }
+#endif
 
-        while ((pde = readdir(pd))) { // /proc/PID
-            if (pde->d_name[0] >= '0' && pde->d_name[0] <= '9' && atoi(pde->d_name) != mypid) {
-                sprintf(dirpath, "/proc/%s", pde->d_name);
-                proc_uid = stat(dirpath, &s) ? -1 : s.st_uid;
+        // list the PIDs to sample first, so the work can be partitioned across workers.
+        // with --tasklist=netlink the full /proc walk only happens on the periodic
+        // reconciliation rescan, otherwise the incrementally maintained set is snapshotted
+        if (stats_every) phase_t0 = stats_now_us();
+        npids = 0;
+        if (tasklist_mode == TASKLIST_NETLINK) {
+            cn_drain();
+            if (rescan_countdown-- <= 0) {
+                rescan_countdown = TASKLIST_RESCAN - 1;
+                pidset_clear();
+                pd = opendir(procfs_root);
+                if (!pd) { fprintf(stderr, "/proc listing error='%s', this shouldn't happen\n", strerror(errno)); exit(1); }
+                while ((pde = readdir(pd))) { // /proc/PID
+                    if (pde->d_name[0] >= '0' && pde->d_name[0] <= '9')
+                        pidset_add(atoi(pde->d_name));
+                }
+                closedir(pd);
+            }
+        }
+        else if (cgroup_dir) {
+            cgroup_listpids(cgroup_dir);
+        }
+        else {
+            pd = opendir(procfs_root);
+            if (!pd) { fprintf(stderr, "/proc listing error='%s', this shouldn't happen\n", strerror(errno)); exit(1); }
+            while ((pde = readdir(pd))) { // /proc/PID
+                if (pde->d_name[0] >= '0' && pde->d_name[0] <= '9')
+                    pidset_add(atoi(pde->d_name));
+            }
+            closedir(pd);
+        }
 
- 
-                // if not multithreaded, read current /proc/PID/x files for efficiency. "nthreads" is 20th field in proc/PID/stat
-                if (readfile(atoi(pde->d_name), 0, "stat", statbuf) > 0) { 
-                    sscanf(statbuf, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %u", &nthreads);
+        for (i = 0; i < pidset_n; i++) {
+            if (pidset_arr[i] == mypid) continue;
+            if (!filter_pid_pass(pidset_arr[i])) continue;        // -p, costs nothing at all
+            if (tiered_k && !tier_check(pidset_arr[i])) continue; // parked in the slow tier
+            if (npids == pids_cap) {
+                pids_cap = pids_cap ? pids_cap * 2 : 1024;
+                pids = realloc(pids, pids_cap * sizeof(int));
+                if (!pids) { fprintf(stderr, "out of memory allocating pid list\n"); exit(1); }
+            }
+            pids[npids++] = pidset_arr[i];
+        }
+        if (tasklist_mode == TASKLIST_SCAN)
+            pidset_clear(); // scan mode rebuilds the listing from scratch every sample
+        if (tiered_k)
+            tier_sweep(); // forget pids that vanished from the listing
+        if (stats_every) {
+            phist_add(PH_LIST, stats_now_us() - phase_t0);
+            stats_scanned += npids;
+        }
 
-                    if (nthreads > 1) {
-                        sprintf(dirpath, "/proc/%s/task", pde->d_name);
+        if (nworkers > 1) {
+            sample_pids = pids;
+            sample_npids = npids;
+            sample_time = timebuf;
+            sample_columns = add_columns;
 
-                        td = opendir(dirpath);
-                        if (td) {
+            pthread_barrier_wait(&start_barrier); // release workers into this sample
+            pthread_barrier_wait(&done_barrier);  // wait until all slices are done
 
-                            while ((tde = readdir(td))) { // proc/PID/task/TID
-                                if (tde->d_name[0] >= '0' && tde->d_name[0] <= '9') {
-                                    outputprocentry(atoi(pde->d_name), atoi(tde->d_name), timebuf, proc_uid, add_columns); 
-                                }
-                            }
-                        }
-                        else {
-                            outputprocpartial(atoi(pde->d_name), -1, timebuf, proc_uid, add_columns, "[task_entry_lost(list)]");
-                        }
-                        closedir(td);
-                    } 
-                    else { // nthreads <= 1, therefore pid == tid
-                        outputprocentry(atoi(pde->d_name), atoi(pde->d_name), timebuf, proc_uid, add_columns);
-                    }
+            // stitch the per-worker buffers back together in pid order
+            total_emitted = 0;
+            for (w = 0; w < nworkers; w++)
+                total_emitted += workers[w].ctx.emitted;
+            if (total_emitted && !summary_every)
+                header_printed = header_printed ? 1 : outputheader(&serial_ctx.ob, add_columns);
+        }
+        else {
+#ifdef HAVE_URING
+            if (engine == ENGINE_URING)
+                uring_sampleslice(&serial_ctx, pids, 0, npids, timebuf, add_columns);
+            else
+#endif
+            for (i = 0; i < npids; i++)
+                sampleprocess(&serial_ctx, pids[i], timebuf, add_columns);
+        }
 
-                } // readfile(statbuf)
-                else {
-                    outputprocpartial(atoi(pde->d_name), -1, timebuf, proc_uid, add_columns, "[proc_entry_lost(list)]");
-                    if (DEBUG) fprintf(stderr, "proc entry disappeared /proc/%s/stat, len=%zu, errno=%s\n", pde->d_name, strlen(statbuf), strerror(errno));
-                }
-            }
+#ifdef HAVE_LIBBPF
+sample_done:
+#endif
+        fdc_evict(); // close cached fds of tasks that exited since the previous sample
+
+        if (stats_every) {
+            stats_emitted += serial_ctx.emitted;
+            if (nworkers > 1)
+                for (w = 0; w < nworkers; w++)
+                    stats_emitted += workers[w].ctx.emitted;
+            if (++stats_samples >= stats_every)
+                stats_report();
         }
-        closedir(pd);
 
-        if (!output_dir && header_printed) fprintf(stdout, "\n");
+        if (metrics_port) { // the sample is complete, let scrapes see it
+            long emitted = serial_ctx.emitted;
+            if (nworkers > 1)
+                for (w = 0; w < nworkers; w++)
+                    emitted += workers[w].ctx.emitted;
+            met_publish(npids, emitted);
+        }
+
+        if (summary_every && ++agg_intervals >= summary_every) {
+            agg_emit(&serial_ctx.ob, agg_intervals, add_columns);
+            agg_intervals = 0;
+        }
+
+        if (ring_window) {
+            long dtotal = serial_ctx.dstate;
+            if (nworkers > 1)
+                for (w = 0; w < nworkers; w++)
+                    dtotal += workers[w].ctx.dstate;
+            ring_store(&serial_ctx, workers);
+            if (ring_dump_req) {
+                ring_dump_req = 0;
+                ring_dump("SIGUSR1", add_columns);
+            }
+            else if (ring_dtrigger && dtotal >= ring_dtrigger) {
+                snprintf(timebuf, sizeof(timebuf), "%ld tasks in D state", dtotal);
+                ring_dump(timebuf, add_columns);
+            }
+        }
+        else
+            flushsample(&serial_ctx, workers, !output_dir && header_printed);
 
-        fflush(stdout);
+        // drift-free schedule: every sample targets an absolute CLOCK_MONOTONIC
+        // deadline instead of sleeping "interval minus elapsed", so short intervals
+        // don't accumulate the measurement and wakeup latency of each round. when a
+        // scan overruns, skip to the next deadline on the original grid and account
+        // for the dropped ticks rather than silently stretching the interval
+        clock_gettime(CLOCK_MONOTONIC, &mono_now);
+        overrun = -1; // the first advance is the regular tick, not an overrun
+        do {
+            ts_addmsec(&deadline, interval_msec);
+            overrun++;
+        } while (deadline.tv_sec < mono_now.tv_sec ||
+                 (deadline.tv_sec == mono_now.tv_sec && deadline.tv_nsec <= mono_now.tv_nsec));
+        if (overrun) {
+            ticks_dropped += overrun;
+            fprintf(stderr, "sampling overran the %dms interval, skipped %d ticks (%ld total)\n",
+                    interval_msec, overrun, ticks_dropped);
+        }
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            ; // a signal (SIGUSR1 ring dump request) just restarts the absolute wait
 
-        // sleep for the requested interval minus time spent taking the previous sample
-        gettimeofday(&loop_iteration_end_time, NULL);
-        loop_iteration_msec = timedifference_msec(loop_iteration_start_time, loop_iteration_end_time);
-        sleep_for_msec = interval_msec - loop_iteration_msec;
-        if (sleep_for_msec > 0) usleep(sleep_for_msec * 1000);
-      
     }
 
     return 0;
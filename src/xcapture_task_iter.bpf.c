@@ -0,0 +1,56 @@
+/*
+ *  0x.Tools xCapture - sample thread activity from Linux procfs [https://0x.tools]
+ *  Copyright 2019-2021 Tanel Poder
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ *  BPF task iterator program for xcapture --engine=bpf (kernels >= 5.8).
+ *  One kernel pass snapshots every task's state, current syscall number and
+ *  kernel stack and streams fixed-size records through the iterator seq file,
+ *  avoiding the per-task /proc reads (and the tasklist lock taken by
+ *  /proc/PID/stack) entirely.
+ *
+ *  Build (see the 'ebpf' target in the Makefile):
+ *    bpftool btf dump file /sys/kernel/btf/vmlinux format c > src/vmlinux.h
+ *    clang -O2 -g -target bpf -c src/xcapture_task_iter.bpf.c -o bin/xcapture_task_iter.bpf.o
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+
+#include "../include/xcapture_task_iter.h"
+
+char LICENSE[] SEC("license") = "GPL";
+
+SEC("iter/task")
+int xcap_task_iter(struct bpf_iter__task *ctx)
+{
+    struct seq_file *seq = ctx->meta->seq;
+    struct task_struct *task = ctx->task;
+    struct pt_regs *regs;
+    struct xcap_bpf_rec rec = {};
+    long stack_bytes;
+
+    if (!task)
+        return 0;
+
+    rec.tgid       = BPF_CORE_READ(task, tgid);
+    rec.pid        = BPF_CORE_READ(task, pid);
+    rec.uid        = BPF_CORE_READ(task, real_cred, uid.val);
+    rec.state      = BPF_CORE_READ(task, __state);
+    rec.exit_state = BPF_CORE_READ(task, exit_state);
+    bpf_probe_read_kernel_str(rec.comm, sizeof(rec.comm), task->comm);
+
+    rec.syscall_nr = -1;
+    regs = (struct pt_regs *) bpf_task_pt_regs(task);
+    if (regs)
+        rec.syscall_nr = (int) BPF_CORE_READ(regs, orig_ax);
+
+    stack_bytes = bpf_get_task_stack(task, rec.kstack, sizeof(rec.kstack), 0);
+    rec.kstack_bytes = stack_bytes > 0 ? (unsigned int) stack_bytes : 0;
+
+    bpf_seq_write(seq, &rec, sizeof(rec));
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ *  0x.Tools xcsv - render xcapture -F binary files back into CSV [https://0x.tools]
+ *  Copyright 2019-2021 Tanel Poder
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ *  Usage: xcsv file.xcap [file2.xcap ...]
+ *
+ *  Reads the dictionary-encoded columnar files written by xcapture -o dir -F binary
+ *  (layout in include/xcapture_binfmt.h) and prints the same CSV that -F csv would
+ *  have produced, so downstream consumers like psn don't need to know the format.
+ *
+ *  Rows may reference dictionary entries that appear later in the file (concurrent
+ *  xcapture workers race on interning), so the whole dictionary is collected in a
+ *  first pass before any row is rendered.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <xcapture_binfmt.h>
+
+char **dict = NULL;        /* id -> string, ids count up from 0 per file */
+unsigned int dict_cap = 0;
+
+void dict_set(unsigned int id, const char *str, int len) {
+    unsigned int i;
+    if (id >= dict_cap) {
+        unsigned int newcap = dict_cap ? dict_cap * 2 : 1024;
+        while (id >= newcap) newcap *= 2;
+        dict = realloc(dict, newcap * sizeof(char *));
+        if (!dict) { fprintf(stderr, "out of memory growing dictionary\n"); exit(1); }
+        for (i = dict_cap; i < newcap; i++) dict[i] = NULL;
+        dict_cap = newcap;
+    }
+    free(dict[id]);
+    dict[id] = strndup(str, len);
+}
+
+const char *dict_get(unsigned int id) {
+    return id < dict_cap && dict[id] ? dict[id] : "?";
+}
+
+void dict_reset(void) {
+    unsigned int i;
+    for (i = 0; i < dict_cap; i++) { free(dict[i]); dict[i] = NULL; }
+}
+
+/* little unaligned readers, record fields are packed back to back */
+unsigned short get16(const char *p) { unsigned short v; memcpy(&v, p, 2); return v; }
+unsigned int   get32(const char *p) { unsigned int   v; memcpy(&v, p, 4); return v; }
+long long      get64(const char *p) { long long      v; memcpy(&v, p, 8); return v; }
+
+void put_i64(long long v) {
+    if (v == XCAP_BIN_NOVAL) fputs("-,", stdout);
+    else printf("%lld,", v);
+}
+
+/* schedstat percentages are stored in tenths of a percent */
+void put_pct10(long long v) {
+    if (v == XCAP_BIN_NOVAL) fputs("-,", stdout);
+    else printf("%lld.%lld,", v / 10, v % 10);
+}
+
+/* fixed row part after the tag: ts + pid + tid + uid_id + state + 3 string ids */
+#define ROW_FIXED (8 + 4 + 4 + 4 + 1 + 4 + 4 + 4)
+
+int rowsize(unsigned short colflags) {
+    int n = ROW_FIXED;
+    if (colflags & XCAP_COL_EXE)     n += 4;
+    if (colflags & XCAP_COL_CMDLINE) n += 4;
+    if (colflags & XCAP_COL_CPUTIME) n += 8;
+    if (colflags & XCAP_COL_FLT)     n += 16;
+    if (colflags & XCAP_COL_RSS)     n += 8;
+    if (colflags & XCAP_COL_PRIO)    n += 8;
+    if (colflags & XCAP_COL_CPUID)   n += 8;
+    if (colflags & XCAP_COL_SCHED)   n += 16;
+    if (colflags & XCAP_COL_KSTACK)  n += 4;
+    return n;
+}
+
+int convertfile(const char *path) {
+
+    FILE *f = fopen(path, "r");
+    char *buf, *p, *end;
+    long size;
+    unsigned short colflags;
+    int nrow, pass;
+    char *q;
+    char tsbuf[32];
+    time_t ts_sec;
+    struct tm *tm;
+
+    if (!f) { fprintf(stderr, "%s: %s\n", path, strerror(errno)); return 1; }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(size ? size : 1);
+    if (!buf || fread(buf, 1, size, f) != (size_t) size) {
+        fprintf(stderr, "%s: short read\n", path);
+        fclose(f);
+        free(buf);
+        return 1;
+    }
+    fclose(f);
+
+    if (size < 8 || memcmp(buf, XCAP_BIN_MAGIC, 4) || get16(buf + 4) != XCAP_BIN_VERSION) {
+        fprintf(stderr, "%s: not an xcapture binary (.xcap) file\n", path);
+        free(buf);
+        return 1;
+    }
+    colflags = get16(buf + 6);
+    nrow = rowsize(colflags);
+    dict_reset();
+
+    /* pass 0 collects the dictionary, pass 1 renders the rows */
+    for (pass = 0; pass < 2; pass++) {
+        p = buf + 8;
+        end = buf + size;
+        if (pass) {
+            printf("TS,PID,TID,USERNAME,ST,COMMAND,SYSCALL,WCHAN");
+            if (colflags & XCAP_COL_EXE)     printf(",EXE");
+            if (colflags & XCAP_COL_CMDLINE) printf(",CMDLINE");
+            if (colflags & XCAP_COL_CPUTIME) printf(",CPUTICKS");
+            if (colflags & XCAP_COL_FLT)     printf(",MINFLT,MAJFLT");
+            if (colflags & XCAP_COL_RSS)     printf(",RSS");
+            if (colflags & XCAP_COL_PRIO)    printf(",PRIO");
+            if (colflags & XCAP_COL_CPUID)   printf(",CPU");
+            if (colflags & XCAP_COL_SCHED)   printf(",CPU%%,LAT%%");
+            if (colflags & XCAP_COL_KSTACK)  printf(",KSTACK");
+            printf("\n");
+        }
+        while (p < end) {
+            if (*p == XCAP_TAG_DICT) {
+                if (p + 7 > end || p + 7 + get16(p + 5) > end) break; /* truncated tail */
+                if (!pass)
+                    dict_set(get32(p + 1), p + 7, get16(p + 5));
+                p += 7 + get16(p + 5);
+            }
+            else if (*p == XCAP_TAG_ROW) {
+                if (p + 1 + nrow > end) break;
+                if (pass) {
+                    long long ts_ms = get64(p + 1);
+                    ts_sec = ts_ms / 1000;
+                    tm = localtime(&ts_sec);
+                    strftime(tsbuf, sizeof(tsbuf), "%Y-%m-%d %H:%M:%S", tm);
+                    printf("%s.%03d,%d,%d,%s,%c,%s,%s,%s,", tsbuf, (int) (ts_ms % 1000),
+                           (int) get32(p + 9), (int) get32(p + 13),
+                           dict_get(get32(p + 17)), p[21],
+                           dict_get(get32(p + 22)), dict_get(get32(p + 26)), dict_get(get32(p + 30)));
+                    q = p + 1 + ROW_FIXED;
+                    if (colflags & XCAP_COL_EXE)     { printf("%s,", dict_get(get32(q))); q += 4; }
+                    if (colflags & XCAP_COL_CMDLINE) { printf("%s,", dict_get(get32(q))); q += 4; }
+                    if (colflags & XCAP_COL_CPUTIME) { put_i64(get64(q)); q += 8; }
+                    if (colflags & XCAP_COL_FLT)     { put_i64(get64(q)); put_i64(get64(q + 8)); q += 16; }
+                    if (colflags & XCAP_COL_RSS)     { put_i64(get64(q)); q += 8; }
+                    if (colflags & XCAP_COL_PRIO)    { put_i64(get64(q)); q += 8; }
+                    if (colflags & XCAP_COL_CPUID)   { put_i64(get64(q)); q += 8; }
+                    if (colflags & XCAP_COL_SCHED)   { put_pct10(get64(q)); put_pct10(get64(q + 8)); q += 16; }
+                    /* the kstack column carries no trailing separator, like xcapture's own CSV */
+                    if (colflags & XCAP_COL_KSTACK)  { printf("%s", dict_get(get32(q))); q += 4; }
+                    printf("\n");
+                }
+                p += 1 + nrow;
+            }
+            else {
+                fprintf(stderr, "%s: unknown record tag 0x%02x at offset %ld, stopping\n",
+                        path, (unsigned char) *p, (long) (p - buf));
+                break;
+            }
+        }
+    }
+
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int i, rc = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: xcsv file.xcap [file2.xcap ...]\n");
+        return 1;
+    }
+    for (i = 1; i < argc; i++)
+        rc |= convertfile(argv[i]);
+    return rc;
+}
@@ -0,0 +1,227 @@
+/*
+ *  0x.Tools xq - time-range queries over the xcapture -o CSV archive [https://0x.tools]
+ *  Copyright 2019-2021 Tanel Poder
+ *
+ *  SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ *  Usage: xq [-b "YYYY-MM-DD HH:MM:SS"] [-e "YYYY-MM-DD HH:MM:SS"] [-m COL=VALUE]... file.csv ...
+ *
+ *  Answers "what was running between 03:14:00 and 03:14:30 last Tuesday" without
+ *  grepping gigabytes: each hourly file is mmap'ed and, when xcapture left a
+ *  <file>.xidx sidecar (see include/xcapture_binfmt.h), a binary search over the
+ *  timestamp -> byte offset entries jumps straight to the matching extent. The
+ *  fixed-format timestamps compare correctly as plain strings, so -b/-e also
+ *  accept prefixes like "2026-08-31 03:14" and rows past -e end the scan early.
+ *
+ *  -m filters match a substring against a named column (from the file's header
+ *  line), repeatable up to 16 times, all must match. Compressed (.zst) and
+ *  -F binary (.xcap) files are not scanned directly - decompress or render
+ *  them with zstdcat / bin/xcsv first.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <xcapture_binfmt.h>
+
+#define MAXFILTERS 16
+
+char *begin_str = NULL, *end_str = NULL;  // raw -b / -e values, compared as strings
+long long begin_ms = -1;                  // -b parsed to epoch ms for the index search,
+                                          // -1 when not given or not fully parseable
+char *filter_col[MAXFILTERS];
+char *filter_val[MAXFILTERS];
+int nfilters = 0;
+
+// fully specified timestamps get parsed for the index binary search, prefix
+// arguments just fall back to scanning from the first row (string compares
+// still bound the output correctly)
+long long parse_ts_ms(const char *str) {
+    struct tm tm = { 0 };
+    const char *rest = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+    if (!rest) return -1;
+    tm.tm_isdst = -1; // the archive timestamps are local time
+    return (long long) mktime(&tm) * 1000;
+}
+
+// resolve -m column names against this file's header line, -1 = no such column
+int colindex(const char *hdr, const char *hdrend, const char *name) {
+    const char *p = hdr;
+    int col = 0, n = strlen(name);
+    while (p < hdrend) {
+        if ((hdrend - p > n && !strncmp(p, name, n) && p[n] == ',') ||
+            (hdrend - p == n && !strncmp(p, name, n)))
+            return col;
+        p = memchr(p, ',', hdrend - p);
+        if (!p) break;
+        p++;
+        col++;
+    }
+    return -1;
+}
+
+// does this row pass all -m filters? fields are walked by comma, the last
+// column (kstack) runs to the end of the line
+int rowmatch(const char *row, const char *rowend, int *filter_ix) {
+    const char *p, *fend;
+    int f, col;
+
+    for (f = 0; f < nfilters; f++) {
+        if (filter_ix[f] < 0) return 0; // the column doesn't exist in this file
+        p = row;
+        for (col = 0; col < filter_ix[f] && p; col++) {
+            p = memchr(p, ',', rowend - p);
+            if (p) p++;
+        }
+        if (!p) return 0;
+        fend = memchr(p, ',', rowend - p);
+        if (!fend) fend = rowend;
+        if (!memmem(p, fend - p, filter_val[f], strlen(filter_val[f]))) return 0;
+    }
+    return 1;
+}
+
+int queryfile(const char *path) {
+
+    char idxpath[4096];
+    int fd, idxfd, f;
+    struct stat st, idxst;
+    char *map, *idxmap = NULL;
+    const char *p, *end, *line, *nl, *hdrend;
+    long long ts;
+    unsigned long long nent, lo, hi, mid;
+    int filter_ix[MAXFILTERS];
+    int beglen = begin_str ? strlen(begin_str) : 0;
+    int endlen = end_str ? strlen(end_str) : 0;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) { fprintf(stderr, "%s: %s\n", path, strerror(errno)); return 1; }
+    if (fstat(fd, &st) || !st.st_size) { close(fd); return 0; }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno)); return 1; }
+    end = map + st.st_size;
+
+    // the header line names the columns for -m, and marks where the data starts
+    hdrend = memchr(map, '\n', st.st_size);
+    if (!hdrend) { munmap(map, st.st_size); return 0; }
+    for (f = 0; f < nfilters; f++)
+        filter_ix[f] = colindex(map, hdrend, filter_col[f]);
+    p = hdrend + 1;
+
+    // with a sidecar index and a fully parsed -b, seek to the last sample at or
+    // before the range start instead of scanning from the top of the file
+    if (begin_ms >= 0) {
+        snprintf(idxpath, sizeof(idxpath), "%s.xidx", path);
+        idxfd = open(idxpath, O_RDONLY);
+        if (idxfd >= 0) {
+            if (!fstat(idxfd, &idxst) && idxst.st_size >= 8)
+                idxmap = mmap(NULL, idxst.st_size, PROT_READ, MAP_PRIVATE, idxfd, 0);
+            close(idxfd);
+            if (idxmap && idxmap != MAP_FAILED && !memcmp(idxmap, XCAP_IDX_MAGIC, 4)) {
+                nent = (idxst.st_size - 8) / 16;
+                lo = 0;
+                hi = nent; // first entry with ts > begin_ms ends up in lo
+                while (lo < hi) {
+                    mid = (lo + hi) / 2;
+                    memcpy(&ts, idxmap + 8 + mid * 16, 8);
+                    if (ts <= begin_ms) lo = mid + 1; else hi = mid;
+                }
+                if (lo > 0) {
+                    unsigned long long off;
+                    memcpy(&off, idxmap + 8 + (lo - 1) * 16 + 8, 8);
+                    if (off > (unsigned long long) (hdrend + 1 - map) &&
+                        off < (unsigned long long) st.st_size)
+                        p = map + off;
+                }
+            }
+            if (idxmap && idxmap != MAP_FAILED) munmap(idxmap, idxst.st_size);
+        }
+    }
+
+    for (; p < end; p = nl + 1) {
+        line = p;
+        nl = memchr(p, '\n', end - p);
+        if (!nl) nl = end;
+        if (nl == line) continue;                                 // blank line
+        if (*line < '0' || *line > '9') continue;                 // repeated header line (a file
+                                                                  // appended to across restarts),
+                                                                  // not a row the bounds apply to
+        if (beglen && nl - line >= beglen && memcmp(line, begin_str, beglen) < 0) continue;
+        if (endlen && nl - line >= endlen && memcmp(line, end_str, endlen) > 0) break;
+        if (nfilters && !rowmatch(line, nl, filter_ix)) continue;
+        fwrite(line, 1, nl - line, stdout);
+        putchar('\n');
+    }
+
+    munmap(map, st.st_size);
+    return 0;
+}
+
+void printhelp() {
+    fprintf(stderr,
+    "\n0x.Tools xq by Tanel Poder [https://0x.tools]\n\n"
+    "Usage:\n"
+    "  xq [options] file.csv [file2.csv ...]\n\n"
+    "  Options:\n"
+    "    -b <ts>        range begin, \"YYYY-MM-DD HH:MM:SS\" or any prefix of it\n"
+    "    -e <ts>        range end (inclusive), same format\n"
+    "    -m <COL=VAL>   only rows where column COL (header name) contains VAL,\n"
+    "                   repeatable, all filters must match\n"
+    "    -h             display this help message\n\n"
+    "  Files written by xcapture -o carry a .xidx time index sidecar (created at\n"
+    "  rotation) that lets -b seek instead of scan. Render .xcap files with xcsv\n"
+    "  and decompress .zst files before querying them.\n");
+}
+
+int main(int argc, char **argv) {
+    int c, i, rc = 0;
+    char *eq;
+
+    while ((c = getopt(argc, argv, "b:e:m:h")) != -1)
+        switch (c) {
+            case 'b':
+                begin_str = optarg;
+                begin_ms = parse_ts_ms(optarg);
+                break;
+            case 'e':
+                end_str = optarg;
+                break;
+            case 'm':
+                eq = strchr(optarg, '=');
+                if (!eq || eq == optarg || !eq[1]) {
+                    fprintf(stderr, "Option -m needs COL=VALUE - %s\n", optarg);
+                    return 1;
+                }
+                if (nfilters == MAXFILTERS) {
+                    fprintf(stderr, "Too many -m filters (max %d)\n", MAXFILTERS);
+                    return 1;
+                }
+                *eq = 0;
+                filter_col[nfilters] = optarg;
+                filter_val[nfilters] = eq + 1;
+                nfilters++;
+                break;
+            case 'h':
+            default:
+                printhelp();
+                return 1;
+        }
+
+    if (optind == argc) {
+        printhelp();
+        return 1;
+    }
+    for (i = optind; i < argc; i++)
+        rc |= queryfile(argv[i]);
+    return rc;
+}